@@ -0,0 +1,657 @@
+#define _GNU_SOURCE
+#include <time.h>
+
+// Đồng hồ cho STBI_JPEG_STATS (monotonic, tính bằng giây)
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define STBI_THREADS
+#define STBI_JPEG_STATS
+#define STBI_TIMER() bench_now()
+#define STB_IMAGE_IMPLEMENTATION
+#include "pool.h"
+// Cấp phát qua pool như imgv
+#define STBI_MALLOC(sz)        pool_malloc(sz)
+#define STBI_REALLOC(p, newsz) pool_realloc(p, newsz)
+#define STBI_FREE(p)           pool_free(p)
+#define DOWNSCALE_MALLOC(sz)   pool_malloc(sz)
+#define DOWNSCALE_FREE(p)      pool_free(p)
+#include "stb_image.h"
+#include "resize_simd.h"
+#include "downscale.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Profile của stbir; CPU không có profiler (xem resize_simd.h) chỉ in thời gian
+#ifdef STBIR_PROFILE
+typedef STBIR_PROFILE_INFO BenchProfile;
+#else
+typedef int BenchProfile;
+#endif
+
+// Benchmark giải mã không cần SDL: đo thời gian tải từng file, thời gian
+// của từng scan JPEG và từng frame GIF, tùy chọn so sánh với kernel tham chiếu.
+// Với --resize đo thêm bước thu nhỏ ảnh vừa khung như imgv, với từng bản
+// SIMD của stb_image_resize2 mà CPU chạy được.
+
+#define BENCH_GIF_PRINT_FRAMES 32
+
+typedef struct {
+    double total;            // thời gian stbi_load nhỏ nhất
+    int w, h;                // kích thước ảnh trả về
+    stbi_jpeg_stats jpeg;    // thời gian nhỏ nhất của từng scan qua các lần chạy
+} BenchResult;
+
+typedef struct {
+    double total;            // tổng thời gian giải mã các frame
+    int w, h, frames;
+    double *frame;           // thời gian nhỏ nhất của từng frame qua các lần chạy
+    int (*rect)[4];          // vùng thay đổi của từng frame
+} GifResult;
+
+typedef struct {
+    double fast_total, ref_total;
+    double fast_refine, ref_refine;   // tổng các scan refinement AC
+    int files;
+} BenchSummary;
+
+static int run_load(const char *filepath, int repeat, int reference, BenchResult *res) {
+    stbi_jpeg_stats stats;
+    int i, k;
+
+    stbi_set_reference_kernels(reference);
+    stbi_set_jpeg_stats(&stats);
+    memset(res, 0, sizeof(*res));
+
+    for (i = 0; i < repeat; i++) {
+        int w, h;
+        double t0 = bench_now();
+        memset(&stats, 0, sizeof(stats));
+        unsigned char *data = stbi_load(filepath, &w, &h, NULL, 4);
+        double t = bench_now() - t0;
+        if (!data) {
+            stbi_set_jpeg_stats(NULL);
+            return 0;
+        }
+        stbi_image_free(data);
+
+        if (i == 0) {
+            res->total = t;
+            res->w = w;
+            res->h = h;
+            res->jpeg = stats;
+            continue;
+        }
+        if (t < res->total) res->total = t;
+        for (k = 0; k < stats.scan_count && k < STBI_JPEG_STATS_MAX_SCANS; k++) {
+            if (stats.scan[k].seconds < res->jpeg.scan[k].seconds)
+                res->jpeg.scan[k].seconds = stats.scan[k].seconds;
+        }
+        if (stats.reconstruct_seconds < res->jpeg.reconstruct_seconds)
+            res->jpeg.reconstruct_seconds = stats.reconstruct_seconds;
+    }
+
+    stbi_set_jpeg_stats(NULL);
+    return 1;
+}
+
+// Giải mã lần lượt từng frame bằng stbi_gif_stream, lấy thời gian nhỏ nhất của mỗi frame
+static int run_gif(const char *filepath, int repeat, int reference, GifResult *res) {
+    int i, cap = 0;
+
+    stbi_set_reference_kernels(reference);
+    memset(res, 0, sizeof(*res));
+
+    for (i = 0; i < repeat; i++) {
+        int delay, rect[4], k = 0;
+        stbi_gif_stream *gs = stbi_gif_stream_open(filepath, &res->w, &res->h);
+        if (!gs) return 0;
+
+        for (;;) {
+            double t0 = bench_now();
+            const stbi_uc *frame = stbi_gif_stream_next(gs, &delay, rect);
+            double t = bench_now() - t0;
+            if (!frame) break;
+
+            if (k >= cap) {
+                cap = cap ? cap * 2 : 64;
+                res->frame = realloc(res->frame, cap * sizeof(*res->frame));
+                res->rect = realloc(res->rect, cap * sizeof(*res->rect));
+                if (!res->frame || !res->rect) {
+                    stbi_gif_stream_close(gs);
+                    return 0;
+                }
+            }
+            if (i == 0 || k >= res->frames) {
+                res->frame[k] = t;
+                memcpy(res->rect[k], rect, sizeof(rect));
+            } else if (t < res->frame[k]) {
+                res->frame[k] = t;
+            }
+            k++;
+        }
+        stbi_gif_stream_close(gs);
+        if (k > res->frames) res->frames = k;
+    }
+
+    for (i = 0; i < res->frames; i++)
+        res->total += res->frame[i];
+    return res->frames > 0;
+}
+
+static void free_gif(GifResult *res) {
+    free(res->frame);
+    free(res->rect);
+}
+
+static void print_gif(const GifResult *fast, const GifResult *ref) {
+    int n = fast->frames < BENCH_GIF_PRINT_FRAMES ? fast->frames : BENCH_GIF_PRINT_FRAMES;
+    double slowest = 0;
+    char area[32];
+
+    if (ref)
+        printf("  %5s  %-20s %10s %10s %8s\n", "frame", "vùng thay đổi", "ms", "ref ms", "speedup");
+    else
+        printf("  %5s  %-20s %10s\n", "frame", "vùng thay đổi", "ms");
+
+    for (int i = 0; i < fast->frames; i++) {
+        double t = fast->frame[i];
+        if (t > slowest) slowest = t;
+        if (i >= n) continue;
+        snprintf(area, sizeof(area), "%dx%d+%d+%d", fast->rect[i][2], fast->rect[i][3], fast->rect[i][0], fast->rect[i][1]);
+        printf("  %5d  %-20s %10.3f", i, area, t * 1000);
+        if (ref && i < ref->frames) {
+            double r = ref->frame[i];
+            printf(" %10.3f %7.2fx", r * 1000, t > 0 ? r / t : 0.0);
+        }
+        printf("\n");
+    }
+    if (fast->frames > n)
+        printf("  ... %d frame không in ra\n", fast->frames - n);
+    printf("  trung bình %.3f ms/frame, chậm nhất %.3f ms\n", fast->total * 1000 / fast->frames, slowest * 1000);
+}
+
+static void bench_gif(const char *filepath, int repeat, int compare, BenchSummary *sum) {
+    GifResult fast, ref;
+
+    memset(&ref, 0, sizeof(ref));
+    if (!run_gif(filepath, repeat, 0, &fast) || (compare && !run_gif(filepath, repeat, 1, &ref))) {
+        printf("%s: không thể giải mã GIF (%s)\n", filepath, stbi_failure_reason());
+        free_gif(&fast);
+        free_gif(&ref);
+        return;
+    }
+
+    printf("%s: %dx%d GIF, %d frame, %.3f ms", filepath, fast.w, fast.h, fast.frames, fast.total * 1000);
+    if (compare)
+        printf(" (ref %.3f ms, %.2fx)", ref.total * 1000, ref.total / fast.total);
+    printf("\n");
+    print_gif(&fast, compare ? &ref : NULL);
+
+    sum->files++;
+    sum->fast_total += fast.total;
+    if (compare)
+        sum->ref_total += ref.total;
+    free_gif(&fast);
+    free_gif(&ref);
+}
+
+// PSNR của các kênh màu giữa hai ảnh RGBA
+static double psnr_rgb(const unsigned char *a, const unsigned char *b, size_t pixels) {
+    double se = 0;
+    for (size_t i = 0; i < pixels * 4; i++) {
+        if ((i & 3) == 3) continue;
+        double d = (double)a[i] - b[i];
+        se += d * d;
+    }
+    se /= pixels * 3;
+    return se > 0 ? 10 * log10(255.0 * 255.0 / se) : INFINITY;
+}
+
+// Resize trực tiếp bằng một bản stbir qua API mở rộng để lấy profile của lần nhanh nhất
+static double time_stbir(const ResizeKernels *k, const unsigned char *data, int w, int h,
+                         unsigned char *out, int out_w, int out_h, stbir_pixel_layout layout,
+                         int repeat, BenchProfile *prof) {
+    double best = -1;
+    for (int i = 0; i < repeat; i++) {
+        STBIR_RESIZE resize;
+        double t0 = bench_now();
+        k->resize_init(&resize, data, w, h, 0, out, out_w, out_h, 0, layout, STBIR_TYPE_UINT8_SRGB);
+        int ok = k->build_samplers_with_splits(&resize, 1) && k->resize_extended_split(&resize, 0, 1);
+        double t = bench_now() - t0;
+        if (ok && (best < 0 || t < best)) {
+            best = t;
+#ifdef STBIR_PROFILE
+            k->split_profile_info(prof, &resize, 0, 1);
+#else
+            (void)prof;
+#endif
+        }
+        k->free_samplers(&resize);
+    }
+    return best;
+}
+
+// Thu nhỏ bằng box filter lũy thừa 2 (shift > 0) rồi stb_image_resize2, lấy thời gian nhỏ nhất.
+// Như imgv: opaque = đục theo số kênh, nếu không thì quét alpha của ảnh đưa vào stbir
+static double time_resize(const ResizeKernels *k, const unsigned char *data, int w, int h,
+                          unsigned char *out, int out_w, int out_h,
+                          int repeat, int shift, int opaque, int linear) {
+    double best = 0;
+    for (int i = 0; i < repeat; i++) {
+        const unsigned char *src = data;
+        unsigned char *small = NULL;
+        int sw = w, sh = h;
+        double t0 = bench_now();
+        if (shift > 0) {
+            small = downscale_pow2(data, w, h, w * 4, shift, !opaque, linear, &sw, &sh);
+            if (!small) return -1;
+            src = small;
+        }
+        int src_opaque = opaque || downscale_is_opaque(src, sw, sh, sw * 4);
+        k->resize_uint8_srgb(src, sw, sh, 0, out, out_w, out_h, 0, src_opaque ? STBIR_4CHANNEL : STBIR_RGBA);
+        double t = bench_now() - t0;
+        pool_free(small);
+        if (i == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+// Callback đầu vào của stbir như imgv: dòng lấy thẳng từ bộ giải mã theo dải
+static const void *stream_input(void *optional_output, const void *input_ptr, int num_pixels,
+                                int x, int y, void *context) {
+    (void)optional_output;
+    (void)input_ptr;
+    (void)num_pixels;
+    return stbi_jpeg_stream_row(context, y) + (size_t)x * 4;
+}
+
+// Giải mã một vùng cỡ màn hình ở giữa ảnh qua chỉ mục của lần giải mã theo dải,
+// như imgv khi zoom 1:1 vào ảnh quá lớn
+static void bench_region(const char *filepath, const void *index, int index_len, int w, int h, int repeat) {
+    int rw = w < 1920 ? w : 1920, rh = h < 1080 ? h : 1080;
+    double best = -1;
+    for (int i = 0; i < repeat; i++) {
+        double t0 = bench_now();
+        unsigned char *region = stbi_jpeg_load_region(filepath, index, index_len, (w - rw) / 2, (h - rh) / 2, rw, rh);
+        double t = bench_now() - t0;
+        if (!region) {
+            printf("  vùng qua chỉ mục: không giải mã được (%s)\n", stbi_failure_reason());
+            return;
+        }
+        stbi_image_free(region);
+        if (best < 0 || t < best) best = t;
+    }
+    printf("  vùng %dx%d qua chỉ mục (%.1f KB)  %10.3f ms\n", rw, rh, index_len / 1024.0, best * 1000);
+}
+
+// Giải mã JPEG theo dải ngay trong lúc resize như imgv với ảnh quá lớn: thời gian
+// cả hai bước, bộ nhớ khối lớn cao nhất (pool, sau khi trả hết khối đang giữ) và
+// PSNR so với ref (resize trực tiếp từ ảnh đã giải mã). Sau đó thử giải mã vùng
+// qua chỉ mục lần giải mã này dựng được
+static void bench_stream(const char *filepath, const ResizeKernels *k, const unsigned char *ref,
+                         int out_w, int out_h, int repeat) {
+    unsigned char *out = pool_malloc((size_t)out_w * out_h * 4);
+    if (!out) return;
+    double best = -1;
+    size_t base = 0, peak = 0;
+    void *index = NULL;
+    int index_len = 0, w = 0, h = 0;
+    for (int i = 0; i < repeat; i++) {
+        PoolStats s;
+        pool_trim();
+        pool_get_stats(&s);
+        pool_reset_peak();
+        double t0 = bench_now();
+        stbi_jpeg_stream *js = stbi_jpeg_stream_open(filepath, &w, &h);
+        if (!js) {
+            printf("  theo dải: không dùng được (%s)\n", stbi_failure_reason());
+            stbi_image_free(index);
+            pool_free(out);
+            return;
+        }
+        STBIR_RESIZE resize;
+        k->resize_init(&resize, NULL, w, h, 0, out, out_w, out_h, 0, STBIR_4CHANNEL, STBIR_TYPE_UINT8_SRGB);
+        k->set_pixel_callbacks(&resize, stream_input, NULL);
+        k->set_user_data(&resize, js);
+        int ok = k->build_samplers_with_splits(&resize, 1) && k->resize_extended_split(&resize, 0, 1);
+        k->free_samplers(&resize);
+        double t = bench_now() - t0;
+        if (!ok) {
+            stbi_jpeg_stream_close(js);
+            break;
+        }
+        if (best < 0 || t < best) best = t;
+        base = s.in_use;
+        pool_get_stats(&s);
+        peak = s.peak - base;
+        if (!index) index = stbi_jpeg_stream_index(js, &index_len);
+        stbi_jpeg_stream_close(js);
+    }
+    if (best > 0)
+        printf("  theo dải + stbir %s %10.3f ms, bộ nhớ cao nhất %.2f MB (ngoài ảnh đích), PSNR %.2f dB\n",
+               k->name, best * 1000, peak / 1048576.0, psnr_rgb(ref, out, (size_t)out_w * out_h));
+    pool_free(out);
+    if (index) {
+        bench_region(filepath, index, index_len, w, h, repeat);
+        stbi_image_free(index);
+    }
+}
+
+// In các giai đoạn theo profiler của stbir, % của tổng số clock
+static void print_stbir_profile(const BenchProfile *prof) {
+#ifdef STBIR_PROFILE
+    const char *sep = " |";
+    for (unsigned int z = 0; z < prof->count; z++) {
+        if (prof->total_clocks && prof->clocks[z] * 100 >= prof->total_clocks) {
+            printf("%s %s %d%%", sep, prof->descriptions[z], (int)(prof->clocks[z] * 100 / prof->total_clocks));
+            sep = ",";
+        }
+    }
+#else
+    (void)prof;
+#endif
+    printf("\n");
+}
+
+// Thu nhỏ vừa khung fit_w x fit_h như imgv: stb_image_resize2 trực tiếp với từng bản
+// SIMD (kèm profile của stbir), ảnh đục thêm lần chạy RGBA để so với STBIR_4CHANNEL,
+// rồi box filter lũy thừa 2 + bản imgv chọn (thời gian và PSNR so với cách trực tiếp)
+static void bench_resize(const char *filepath, int img_w, int img_h, int comp, int fit_w, int fit_h, int repeat) {
+    int w, h;
+    unsigned char *data = stbi_load(filepath, &w, &h, NULL, 4);
+    if (!data) return;
+
+    int out_w = img_w, out_h = img_h;
+    if (out_w > fit_w || out_h > fit_h) {
+        float scale_w = (float)fit_w / img_w;
+        float scale_h = (float)fit_h / img_h;
+        float scale = scale_w < scale_h ? scale_w : scale_h;
+        out_w = (int)(img_w * scale);
+        out_h = (int)(img_h * scale);
+    }
+    if (out_w < 1) out_w = 1;
+    if (out_h < 1) out_h = 1;
+
+    int shift = downscale_pow2_shift(w, h, out_w, out_h);
+    // Ảnh đục (theo số kênh hoặc quét alpha) resize bằng STBIR_4CHANNEL
+    double scan = 0;
+    int format_opaque = comp == 1 || comp == 3;
+    int opaque = format_opaque;
+    if (!opaque) {
+        double t0 = bench_now();
+        opaque = downscale_is_opaque(data, w, h, w * 4);
+        scan = bench_now() - t0;
+    }
+    stbir_pixel_layout layout = opaque ? STBIR_4CHANNEL : STBIR_RGBA;
+    unsigned char *ref = malloc((size_t)out_w * out_h * 4);
+    unsigned char *out = malloc((size_t)out_w * out_h * 4);
+    if (!ref || !out) {
+        free(ref);
+        free(out);
+        stbi_image_free(data);
+        return;
+    }
+
+    const ResizeKernels *variants[RESIZE_MAX_VARIANTS];
+    const ResizeKernels *selected = resize_kernels_select();
+    int nv = resize_kernels_supported(variants, RESIZE_MAX_VARIANTS);
+    double direct = 0, base = 0;
+
+    printf("  resize %dx%d -> %dx%d (imgv dùng stbir %s, %s", w, h, out_w, out_h, selected->name,
+           opaque ? "ảnh đục, 4CHANNEL" : "có alpha, RGBA");
+    if (comp == 2 || comp == 4) printf(", quét alpha %.3f ms", scan * 1000);
+    printf(")\n");
+    for (int v = 0; v < nv; v++) {
+        BenchProfile prof;
+        unsigned char *dst = variants[v] == selected ? ref : out;
+        double t = time_stbir(variants[v], data, w, h, dst, out_w, out_h, layout, repeat, &prof);
+        if (t < 0) continue;
+        if (v == 0) base = t;
+        if (variants[v] == selected) direct = t;
+        printf("  stbir %-7s %10.3f ms", variants[v]->name, t * 1000);
+        if (v > 0) printf(" (%.2fx)", base / t);
+        print_stbir_profile(&prof);
+    }
+    if (opaque && direct > 0) {
+        // Cách cũ: RGBA có nhân/chia alpha, cùng bản SIMD
+        BenchProfile prof;
+        double t = time_stbir(selected, data, w, h, out, out_w, out_h, STBIR_RGBA, repeat, &prof);
+        if (t > 0) {
+            printf("  stbir %-7s %10.3f ms RGBA (4CHANNEL nhanh hơn %.2fx, PSNR %.2f dB)", selected->name,
+                   t * 1000, t / direct, psnr_rgb(ref, out, (size_t)out_w * out_h));
+            print_stbir_profile(&prof);
+        }
+    }
+    if (direct > 0 && format_opaque)
+        bench_stream(filepath, selected, ref, out_w, out_h, repeat);
+    if (direct <= 0) {
+        free(ref);
+        free(out);
+        stbi_image_free(data);
+        return;
+    }
+    if (shift > 0) {
+        for (int linear = 0; linear < 2; linear++) {
+            double t = time_resize(selected, data, w, h, out, out_w, out_h, repeat, shift, format_opaque, linear);
+            if (t < 0) break;
+            printf("  box 1/%d%s + stbir %.3f ms (%.2fx), PSNR %.2f dB\n", 1 << shift, linear ? " tuyến tính" : "",
+                   t * 1000, direct / t, psnr_rgb(ref, out, (size_t)out_w * out_h));
+        }
+    } else {
+        printf("  (chưa tới 2 lần, không dùng box filter)\n");
+    }
+
+    free(ref);
+    free(out);
+    stbi_image_free(data);
+}
+
+static const char *scan_components(int mask, char *buf, size_t size) {
+    static const char *names[4] = { "Y", "Cb", "Cr", "K" };
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < 4; i++) {
+        if (mask & (1 << i))
+            len += snprintf(buf + len, size - len, "%s%s", len ? " " : "", names[i]);
+        if (len >= size) break;
+    }
+    return buf;
+}
+
+static int is_refine_scan(const stbi_jpeg_scan_stats *scan) {
+    return scan->spec_start > 0 && scan->succ_high > 0;
+}
+
+static void print_jpeg(const BenchResult *fast, const BenchResult *ref) {
+    const stbi_jpeg_stats *st = &fast->jpeg;
+    char comps[32];
+    int n = st->scan_count < STBI_JPEG_STATS_MAX_SCANS ? st->scan_count : STBI_JPEG_STATS_MAX_SCANS;
+
+    if (ref)
+        printf("  %4s  %-10s %5s  %5s %10s %10s %8s\n", "scan", "comps", "Ss-Se", "Ah/Al", "ms", "ref ms", "speedup");
+    else
+        printf("  %4s  %-10s %5s  %5s %10s\n", "scan", "comps", "Ss-Se", "Ah/Al", "ms");
+
+    for (int i = 0; i < n; i++) {
+        const stbi_jpeg_scan_stats *sc = &st->scan[i];
+        char band[16], succ[16];
+        snprintf(band, sizeof(band), "%d-%d", sc->spec_start, sc->spec_end);
+        snprintf(succ, sizeof(succ), "%d/%d", sc->succ_high, sc->succ_low);
+        printf("  %4d%s %-10s %5s  %5s %10.3f", i, is_refine_scan(sc) ? "*" : " ",
+               scan_components(sc->components, comps, sizeof(comps)), band, succ, sc->seconds * 1000);
+        if (ref) {
+            double r = ref->jpeg.scan[i].seconds;
+            printf(" %10.3f %7.2fx", r * 1000, sc->seconds > 0 ? r / sc->seconds : 0.0);
+        }
+        printf("\n");
+    }
+    if (st->scan_count > n)
+        printf("  ... %d scan không được ghi lại\n", st->scan_count - n);
+    char label[64];
+    if (st->pipelined) {
+        // dựng ảnh chạy song song với scan baseline, đã tính vào thời gian scan
+        printf("  IDCT + upsample + YCbCr trong scan (pipeline, %d luồng)\n", st->threads);
+        return;
+    }
+    snprintf(label, sizeof(label), "%s, %d luồng", st->progressive ? "IDCT + upsample + YCbCr" : "upsample + YCbCr", st->threads);
+    printf("  %-34s %10.3f", label, st->reconstruct_seconds * 1000);
+    if (ref) {
+        double r = ref->jpeg.reconstruct_seconds;
+        printf(" %10.3f %7.2fx", r * 1000, st->reconstruct_seconds > 0 ? r / st->reconstruct_seconds : 0.0);
+    }
+    printf("\n");
+}
+
+// Giải mã JPEG ra ba mặt phẳng Y, Cb, Cr như imgv khi renderer có texture IYUV;
+// so với stbi_load RGBA (total) và số byte phải tải lên texture
+static void bench_yuv(const char *filepath, int repeat, double total) {
+    double best = -1;
+    int w = 0, h = 0;
+    for (int i = 0; i < repeat; i++) {
+        double t0 = bench_now();
+        unsigned char *data = stbi_load_jpeg_yuv(filepath, &w, &h);
+        double t = bench_now() - t0;
+        if (!data) {
+            printf("  YUV: không dùng được (%s)\n", stbi_failure_reason());
+            return;
+        }
+        stbi_image_free(data);
+        if (best < 0 || t < best) best = t;
+    }
+    size_t bytes = (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+    printf("  YUV 4:2:0 %dx%d %10.3f ms (%.2fx), tải lên %.2f MB thay vì %.2f MB\n", w, h, best * 1000,
+           total / best, bytes / 1e6, (double)w * h * 4 / 1e6);
+}
+
+static double refine_seconds(const stbi_jpeg_stats *st) {
+    double sum = 0;
+    for (int i = 0; i < st->scan_count && i < STBI_JPEG_STATS_MAX_SCANS; i++)
+        if (is_refine_scan(&st->scan[i])) sum += st->scan[i].seconds;
+    return sum;
+}
+
+static void bench_file(const char *filepath, int repeat, int compare, int yuv, int fit_w, int fit_h, int pool,
+                       BenchSummary *sum) {
+    BenchResult fast, ref;
+    int w, h, comp;
+    stbi_gif_stream *gs;
+
+    if (!stbi_info(filepath, &w, &h, &comp)) {
+        printf("%s: không đọc được (%s)\n", filepath, stbi_failure_reason());
+        return;
+    }
+    // GIF được đo theo từng frame thay vì chỉ frame đầu như stbi_load
+    if ((gs = stbi_gif_stream_open(filepath, &w, &h)) != NULL) {
+        stbi_gif_stream_close(gs);
+        bench_gif(filepath, repeat, compare, sum);
+        return;
+    }
+    if (!run_load(filepath, repeat, 0, &fast) || (compare && !run_load(filepath, repeat, 1, &ref))) {
+        printf("%s: không thể tải ảnh (%s)\n", filepath, stbi_failure_reason());
+        return;
+    }
+
+    printf("%s: %dx%d", filepath, w, h);
+    if (fast.w != w || fast.h != h)
+        printf(" -> %dx%d", fast.w, fast.h);
+    if (fast.jpeg.scan_count)
+        printf(" %s, %d scan", fast.jpeg.progressive ? "progressive" : "baseline", fast.jpeg.scan_count);
+    printf(", %.3f ms", fast.total * 1000);
+    if (compare)
+        printf(" (ref %.3f ms, %.2fx)", ref.total * 1000, ref.total / fast.total);
+    printf("\n");
+    if (fast.jpeg.scan_count)
+        print_jpeg(&fast, compare ? &ref : NULL);
+    if (yuv && fast.jpeg.scan_count)
+        bench_yuv(filepath, repeat, fast.total);
+    if (fit_w > 0)
+        bench_resize(filepath, w, h, comp, fit_w, fit_h, repeat);
+    if (pool)
+        pool_print_stats(stdout, filepath);
+
+    sum->files++;
+    sum->fast_total += fast.total;
+    sum->fast_refine += refine_seconds(&fast.jpeg);
+    if (compare) {
+        sum->ref_total += ref.total;
+        sum->ref_refine += refine_seconds(&ref.jpeg);
+    }
+}
+
+static void usage(const char *prog) {
+    printf("Sử dụng: %s [-n số_lần] [-j số_luồng] [--fit RxC [--resize]] [--compare] [--bgr] [--yuv] [--pool] <ảnh>...\n", prog);
+    printf("  -n số_lần    lặp lại mỗi file, lấy thời gian nhỏ nhất (mặc định 5)\n");
+    printf("  -j số_luồng  số luồng dựng ảnh JPEG (mặc định: số CPU, 1 = không đa luồng)\n");
+    printf("  --fit RxC    giải mã JPEG cho khung RxC như imgv (nửa kích thước nếu thu nhỏ >= 2 lần)\n");
+    printf("  --compare    chạy thêm kernel tham chiếu của stb_image để so sánh\n");
+    printf("  --resize     đo thêm bước thu nhỏ vừa khung --fit (box filter + stbir so với stbir)\n");
+    printf("  --bgr        giải mã ra thứ tự BGRA như imgv khi renderer dùng ARGB8888\n");
+    printf("  --yuv        đo thêm giải mã JPEG ra mặt phẳng Y, Cb, Cr cho texture IYUV\n");
+    printf("  --pool       in thống kê bộ cấp phát và số page fault sau mỗi file\n");
+    printf("Scan đánh dấu * là scan refinement AC của JPEG progressive.\n");
+    printf("GIF được đo theo từng frame (tối đa %d frame đầu được in ra).\n", BENCH_GIF_PRINT_FRAMES);
+}
+
+int main(int argc, char *argv[]) {
+    int repeat = 5;
+    int compare = 0;
+    int resize = 0;
+    int yuv = 0;
+    int pool = 0;
+    int fit_w = 0, fit_h = 0;
+    int first = 1;
+    BenchSummary sum = {0};
+
+    for (; first < argc && argv[first][0] == '-'; first++) {
+        if (strcmp(argv[first], "-n") == 0 && first + 1 < argc) {
+            repeat = atoi(argv[++first]);
+            if (repeat < 1) repeat = 1;
+        } else if (strcmp(argv[first], "-j") == 0 && first + 1 < argc) {
+            stbi_set_thread_count(atoi(argv[++first]));
+        } else if (strcmp(argv[first], "--fit") == 0 && first + 1 < argc) {
+            if (sscanf(argv[++first], "%dx%d", &fit_w, &fit_h) != 2 || fit_w < 1 || fit_h < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            stbi_set_jpeg_fit_size(fit_w, fit_h);
+        } else if (strcmp(argv[first], "--compare") == 0) {
+            compare = 1;
+        } else if (strcmp(argv[first], "--resize") == 0) {
+            resize = 1;
+        } else if (strcmp(argv[first], "--bgr") == 0) {
+            stbi_set_bgr_on_load(1);
+        } else if (strcmp(argv[first], "--yuv") == 0) {
+            yuv = 1;
+        } else if (strcmp(argv[first], "--pool") == 0) {
+            pool = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (first >= argc || (resize && !fit_w)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = first; i < argc; i++)
+        bench_file(argv[i], repeat, compare, yuv, resize ? fit_w : 0, fit_h, pool, &sum);
+
+    if (sum.files > 1) {
+        printf("\nTổng %d file: %.3f ms, refinement AC %.3f ms\n", sum.files,
+               sum.fast_total * 1000, sum.fast_refine * 1000);
+        if (compare)
+            printf("Tham chiếu:    %.3f ms, refinement AC %.3f ms (%.2fx / %.2fx)\n",
+                   sum.ref_total * 1000, sum.ref_refine * 1000,
+                   sum.ref_total / sum.fast_total,
+                   sum.fast_refine > 0 ? sum.ref_refine / sum.fast_refine : 0.0);
+    }
+    return 0;
+}
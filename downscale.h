@@ -0,0 +1,303 @@
+// downscale.h - Thu nhỏ nhanh ảnh RGBA 8-bit theo tỉ lệ lũy thừa của 2
+//
+// Box filter số nguyên: mỗi pixel ra là trung bình một khối 2^k x 2^k pixel
+// vào. Dùng để thu nhỏ ảnh rất lớn trước bước resize chất lượng cao của
+// stb_image_resize2, vốn đổi từng pixel vào sang float tuyến tính nên tốn
+// kém khi số pixel vào gấp hàng chục lần số pixel ra.
+//
+// Khối được cộng dồn theo từng cấp 2x2 và theo từng dòng, mỗi cấp chỉ giữ
+// hai dòng đệm; giá trị trung gian là số 12-bit (255 <-> 4080) nên chỉ làm
+// tròn một lần ở cuối. Ảnh có alpha được nhân trước alpha khi cộng để màu
+// của pixel trong suốt không lem sang pixel bên cạnh.
+
+#ifndef IMGV_DOWNSCALE_H
+#define IMGV_DOWNSCALE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Định nghĩa cả hai trước khi include để dùng bộ cấp phát khác
+#ifndef DOWNSCALE_MALLOC
+#define DOWNSCALE_MALLOC(sz) malloc(sz)
+#define DOWNSCALE_FREE(p)    free(p)
+#endif
+
+#define DOWNSCALE_ONE 4080   // giá trị trung gian của 255
+
+// Bảng tra sRGB <-> tuyến tính cho chế độ linear
+static unsigned short downscale_to_linear[256];
+static unsigned char downscale_to_srgb[DOWNSCALE_ONE + 1];
+static int downscale_tables_ready = 0;
+
+static void downscale_init_tables(void) {
+    if (downscale_tables_ready) return;
+    for (int i = 0; i < 256; i++) {
+        double c = i / 255.0;
+        double l = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        downscale_to_linear[i] = (unsigned short)(l * DOWNSCALE_ONE + 0.5);
+    }
+    for (int i = 0; i <= DOWNSCALE_ONE; i++) {
+        double l = (double)i / DOWNSCALE_ONE;
+        double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+        downscale_to_srgb[i] = (unsigned char)(c * 255 + 0.5);
+    }
+    downscale_tables_ready = 1;
+}
+
+// Số lần chia đôi khi thu nhỏ in -> out: tỉ lệ lũy thừa 2 lớn nhất không làm
+// ảnh trung gian nhỏ hơn ảnh ra; 0 = không cần
+static int downscale_pow2_shift(int in_w, int in_h, int out_w, int out_h) {
+    int shift = 0;
+    if (out_w <= 0 || out_h <= 0) return 0;
+    while (shift < 30 && (in_w >> (shift + 1)) >= out_w && (in_h >> (shift + 1)) >= out_h)
+        shift++;
+    return shift;
+}
+
+// 1 nếu mọi pixel RGBA (w x h, stride tính bằng byte) có alpha = 255.
+// Dừng ở dòng đầu tiên có pixel trong suốt nên ảnh có alpha thật tốn rất ít
+static int downscale_is_opaque(const unsigned char *px, int w, int h, int stride) {
+    for (int y = 0; y < h; y++) {
+        const unsigned char *row = px + (size_t)y * stride;
+        unsigned char acc = 0xFF;
+        int x = 0;
+#ifdef __SSE2__
+        // AND dồn 4 pixel một lần, cuối dòng mới kiểm tra các byte alpha
+        __m128i vacc = _mm_set1_epi8(-1);
+        for (; x + 4 <= w; x += 4)
+            vacc = _mm_and_si128(vacc, _mm_loadu_si128((const __m128i *)(row + x * 4)));
+        if ((_mm_movemask_epi8(_mm_cmpeq_epi8(vacc, _mm_set1_epi8(-1))) & 0x8888) != 0x8888)
+            return 0;
+#endif
+        for (; x < w; x++)
+            acc &= row[x * 4 + 3];
+        if (acc != 0xFF) return 0;
+    }
+    return 1;
+}
+
+// round(x / 255) cho x <= 255 * 255
+#define DOWNSCALE_DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+#ifdef __SSE2__
+// Nhân màu với alpha của chính pixel đó (2 pixel 16-bit mỗi thanh ghi), giữ nguyên alpha
+static __m128i downscale_premultiply_sse2(__m128i px, __m128i alpha_mask) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xFF), 0xFF);
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(px, a), _mm_set1_epi16(128));
+    x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    return _mm_or_si128(_mm_andnot_si128(alpha_mask, x), _mm_and_si128(alpha_mask, px));
+}
+#endif
+
+// Cấp đầu: hai dòng 8-bit -> một dòng trung gian (tổng 2x2 * 4 = trung bình * 16)
+static void downscale_first_row(const unsigned char *r0, const unsigned char *r1, int w,
+                                unsigned short *out, int has_alpha) {
+    int ow = (w + 1) / 2;
+    int j = 0;
+
+#ifdef __SSE2__
+    // 4 pixel vào mỗi dòng -> 2 pixel ra
+    __m128i zero = _mm_setzero_si128();
+    __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    for (; j + 2 <= w / 2; j += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(r0 + j * 8));
+        __m128i b = _mm_loadu_si128((const __m128i *)(r1 + j * 8));
+        __m128i a_lo = _mm_unpacklo_epi8(a, zero), a_hi = _mm_unpackhi_epi8(a, zero);
+        __m128i b_lo = _mm_unpacklo_epi8(b, zero), b_hi = _mm_unpackhi_epi8(b, zero);
+        if (has_alpha) {
+            a_lo = downscale_premultiply_sse2(a_lo, alpha_mask);
+            a_hi = downscale_premultiply_sse2(a_hi, alpha_mask);
+            b_lo = downscale_premultiply_sse2(b_lo, alpha_mask);
+            b_hi = downscale_premultiply_sse2(b_hi, alpha_mask);
+        }
+        __m128i lo = _mm_add_epi16(a_lo, b_lo);
+        __m128i hi = _mm_add_epi16(a_hi, b_hi);
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+        _mm_storeu_si128((__m128i *)(out + j * 4), _mm_slli_epi16(sum, 2));
+    }
+#endif
+
+    for (; j < ow; j++) {
+        int x0 = 2 * j, x1 = 2 * j + 1 < w ? 2 * j + 1 : w - 1;
+        const unsigned char *p[4] = { r0 + x0 * 4, r0 + x1 * 4, r1 + x0 * 4, r1 + x1 * 4 };
+        int sum[4] = { 0, 0, 0, 0 };
+        for (int k = 0; k < 4; k++) {
+            int a = has_alpha ? p[k][3] : 255;
+            for (int c = 0; c < 3; c++)
+                sum[c] += DOWNSCALE_DIV255(p[k][c] * a);
+            sum[3] += p[k][3];
+        }
+        for (int c = 0; c < 4; c++)
+            out[j * 4 + c] = (unsigned short)(sum[c] << 2);
+    }
+}
+
+// Cấp đầu cho chế độ linear: màu qua bảng tra sang 12-bit tuyến tính rồi mới cộng
+static void downscale_first_row_linear(const unsigned char *r0, const unsigned char *r1, int w,
+                                       unsigned short *out, int has_alpha) {
+    const unsigned short *lut = downscale_to_linear;
+    int ow = (w + 1) / 2;
+
+    for (int j = 0; j < ow; j++) {
+        int x0 = 2 * j * 4, x1 = (2 * j + 1 < w ? 2 * j + 1 : w - 1) * 4;
+        for (int c = 0; c < 3; c++) {
+            int sum;
+            if (has_alpha)
+                sum = (lut[r0[x0 + c]] * r0[x0 + 3] + lut[r0[x1 + c]] * r0[x1 + 3] +
+                       lut[r1[x0 + c]] * r1[x0 + 3] + lut[r1[x1 + c]] * r1[x1 + 3] + 510) / 1020;
+            else
+                sum = (lut[r0[x0 + c]] + lut[r0[x1 + c]] + lut[r1[x0 + c]] + lut[r1[x1 + c]] + 2) >> 2;
+            out[j * 4 + c] = (unsigned short)sum;
+        }
+        out[j * 4 + 3] = (unsigned short)((r0[x0 + 3] + r0[x1 + 3] + r1[x0 + 3] + r1[x1 + 3]) << 2);
+    }
+}
+
+// Các cấp sau: trung bình 2x2 của hai dòng trung gian
+static void downscale_halve_row(const unsigned short *r0, const unsigned short *r1, int w,
+                                unsigned short *out) {
+    int ow = (w + 1) / 2;
+    int j = 0;
+
+#ifdef __SSE2__
+    __m128i two = _mm_set1_epi16(2);
+    for (; j + 2 <= w / 2; j += 2) {
+        __m128i s0 = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(r0 + j * 8)),
+                                   _mm_loadu_si128((const __m128i *)(r1 + j * 8)));
+        __m128i s1 = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(r0 + j * 8 + 8)),
+                                   _mm_loadu_si128((const __m128i *)(r1 + j * 8 + 8)));
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+        _mm_storeu_si128((__m128i *)(out + j * 4), _mm_srli_epi16(_mm_add_epi16(sum, two), 2));
+    }
+#endif
+
+    for (; j < ow; j++) {
+        int x0 = 2 * j, x1 = 2 * j + 1 < w ? 2 * j + 1 : w - 1;
+        for (int c = 0; c < 4; c++)
+            out[j * 4 + c] = (unsigned short)((r0[x0 * 4 + c] + r0[x1 * 4 + c] +
+                                               r1[x0 * 4 + c] + r1[x1 * 4 + c] + 2) >> 2);
+    }
+}
+
+// Dòng trung gian cuối -> dòng 8-bit: bỏ nhân alpha, đổi về sRGB
+static void downscale_last_row(const unsigned short *in, int w, unsigned char *out,
+                               int has_alpha, int linear) {
+    for (int j = 0; j < w; j++) {
+        int a = in[j * 4 + 3];
+        for (int c = 0; c < 3; c++) {
+            int v = in[j * 4 + c];
+            if (has_alpha) {
+                v = a ? (v * DOWNSCALE_ONE + a / 2) / a : 0;
+                if (v > DOWNSCALE_ONE) v = DOWNSCALE_ONE;
+            }
+            out[j * 4 + c] = linear ? downscale_to_srgb[v] : (unsigned char)((v + 8) >> 4);
+        }
+        out[j * 4 + 3] = (unsigned char)((a + 8) >> 4);
+    }
+}
+
+typedef struct {
+    unsigned short *row[2];   // dòng đang chờ ghép cặp và dòng mới
+    int w;                    // số pixel mỗi dòng ở cấp này
+    int pending;              // row[0] đang chờ dòng thứ hai
+} DownscaleLevel;
+
+typedef struct {
+    DownscaleLevel *level;    // level[k] chứa ảnh đã thu nhỏ 2^(k+1) lần
+    int levels;
+    unsigned char *out;
+    int out_y;
+    int has_alpha, linear;
+} DownscaleState;
+
+// Dòng mới ở level[k] đã nằm trong row[pending]: ghép với dòng chờ hoặc chờ dòng sau
+static void downscale_push_row(DownscaleState *st, int k) {
+    DownscaleLevel *lv = &st->level[k];
+    if (k == st->levels - 1) {
+        downscale_last_row(lv->row[0], lv->w, st->out + (size_t)st->out_y * lv->w * 4,
+                           st->has_alpha, st->linear);
+        st->out_y++;
+        return;
+    }
+    if (!lv->pending) {
+        lv->pending = 1;
+        return;
+    }
+    DownscaleLevel *next = &st->level[k + 1];
+    downscale_halve_row(lv->row[0], lv->row[1], lv->w, next->row[next->pending]);
+    lv->pending = 0;
+    downscale_push_row(st, k + 1);
+}
+
+// Thu nhỏ ảnh RGBA 8-bit (w x h, stride tính bằng byte) 2^shift lần mỗi chiều.
+// Trả về ảnh mới *out_w x *out_h (giải phóng bằng DOWNSCALE_FREE), NULL nếu hết bộ nhớ.
+// Kích thước ra làm tròn lên; khối ở mép lặp lại pixel cuối.
+// has_alpha = 0: kênh thứ tư được coi là đục (RGBX), bỏ qua bước nhân alpha.
+// linear = 1: lấy trung bình trong không gian tuyến tính thay vì trên giá trị sRGB.
+static unsigned char *downscale_pow2(const unsigned char *in, int w, int h, int stride, int shift,
+                                     int has_alpha, int linear, int *out_w, int *out_h) {
+    DownscaleLevel level[31];
+    DownscaleState st;
+    size_t rows = 0;
+
+    if (shift < 1 || shift > 30 || w <= 0 || h <= 0) return NULL;
+    if (linear) downscale_init_tables();
+
+    int lw = w, lh = h;
+    for (int k = 0; k < shift; k++) {
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+        level[k].w = lw;
+        level[k].pending = 0;
+        rows += (size_t)lw * 4 * 2;
+    }
+    unsigned short *buf = DOWNSCALE_MALLOC(rows * sizeof(unsigned short));
+    unsigned char *out = DOWNSCALE_MALLOC((size_t)lw * lh * 4);
+    if (!buf || !out) {
+        DOWNSCALE_FREE(buf);
+        DOWNSCALE_FREE(out);
+        return NULL;
+    }
+    rows = 0;
+    for (int k = 0; k < shift; k++) {
+        level[k].row[0] = buf + rows;
+        level[k].row[1] = buf + rows + (size_t)level[k].w * 4;
+        rows += (size_t)level[k].w * 4 * 2;
+    }
+
+    st.level = level;
+    st.levels = shift;
+    st.out = out;
+    st.out_y = 0;
+    st.has_alpha = has_alpha;
+    st.linear = linear;
+
+    for (int y = 0; y < h; y += 2) {
+        const unsigned char *r0 = in + (size_t)y * stride;
+        const unsigned char *r1 = y + 1 < h ? r0 + stride : r0;
+        unsigned short *row = level[0].row[level[0].pending];
+        if (linear)
+            downscale_first_row_linear(r0, r1, w, row, has_alpha);
+        else
+            downscale_first_row(r0, r1, w, row, has_alpha);
+        downscale_push_row(&st, 0);
+    }
+    // Dòng lẻ còn chờ ở mép dưới được ghép với chính nó
+    for (int k = 0; k < shift - 1; k++) {
+        if (level[k].pending) {
+            memcpy(level[k].row[1], level[k].row[0], (size_t)level[k].w * 4 * sizeof(unsigned short));
+            downscale_push_row(&st, k);
+        }
+    }
+
+    DOWNSCALE_FREE(buf);
+    *out_w = lw;
+    *out_h = lh;
+    return out;
+}
+
+#endif // IMGV_DOWNSCALE_H
@@ -1,10 +1,21 @@
 #define _GNU_SOURCE
+#define STBI_THREADS
 #define STB_IMAGE_IMPLEMENTATION
+#include "pool.h"
+// Bộ đệm ảnh, bộ giải mã và stbir đều cấp phát qua pool (xem pool.h)
+#define STBI_MALLOC(sz)        pool_malloc(sz)
+#define STBI_REALLOC(p, newsz) pool_realloc(p, newsz)
+#define STBI_FREE(p)           pool_free(p)
+#define DOWNSCALE_MALLOC(sz)   pool_malloc(sz)
+#define DOWNSCALE_FREE(p)      pool_free(p)
 #include "stb_image.h"
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize2.h"
+#include "resize_simd.h"
+#include "downscale.h"
+#include "tiles.h"
+#include "instance.h"
 
 #include <SDL2/SDL.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,23 +29,291 @@ typedef struct {
     int current;
 } ImageList;
 
+// Sampler đã dựng của stb_image_resize2 (hệ số filter + bộ đệm), dùng lại cho
+// các ảnh có cùng kích thước vào/ra và layout
+#define RESIZE_CACHE_SIZE 4
+// Mỗi lần resize chia thành vài dải để có thể hủy giữa chừng
+#define RESIZE_SPLITS 4
+
+typedef struct {
+    STBIR_RESIZE resize;
+    int in_w, in_h, out_w, out_h;
+    stbir_pixel_layout layout;
+    stbir_datatype type;
+    unsigned int last_used;  // để bỏ sampler lâu không dùng nhất khi cache đầy
+    int splits;
+    int valid;
+} ResizeSampler;
+
+// Mỗi luồng resize (chính/làm nét, giải mã trước) có cache riêng
+typedef struct {
+    ResizeSampler slots[RESIZE_CACHE_SIZE];
+    unsigned int clock;
+} ResizeCache;
+
+// Hiển thị hai bước: ảnh xem trước (box filter, GPU co giãn) hiện ngay khi giải mã
+// xong, ảnh resize chất lượng cao được tính ở luồng nền rồi thay vào.
+// Biến môi trường IMGV_REFINE: số ms chờ trước khi bắt đầu làm nét (mặc định 0),
+// "off" = chỉ hiện ảnh xem trước, "sync" = resize chất lượng cao rồi mới hiện
+#define REFINE_SYNC (-1)
+#define REFINE_OFF  (-2)
+// Cửa sổ đổi kích thước: trong lúc kéo GPU co giãn ảnh đang hiện, thôi kéo chừng
+// này ms thì ảnh được resize chất lượng cao lại từ ảnh nguồn
+#define RESCALE_SETTLE_MS 150
+
+typedef struct {
+    SDL_Thread *thread;
+    SDL_atomic_t cancel;    // yêu cầu luồng nền dừng ở dải tiếp theo
+    SDL_atomic_t done;      // luồng nền đã xong, kết quả nằm trong out
+    int pending;            // có ảnh đang chờ làm nét
+    Uint32 start_at;        // SDL_GetTicks() lúc bắt đầu làm nét
+    unsigned char *src;     // ảnh nguồn (ImageViewer.source), không thuộc Refinement
+    int src_w, src_h;
+    stbir_pixel_layout layout;
+    Uint32 format;          // định dạng texture của ảnh nguồn (IYUV = ba mặt phẳng)
+    unsigned char *out;
+    int out_w, out_h;
+    int ok;
+} Refinement;
+
+// Zoom/pan: các mức thu nhỏ 2^k của ảnh gốc (mipmap), dựng lần đầu cần tới. Mức
+// chi tiết nhất giải mã lại từ file, mỗi mức sau là box filter 2x của mức trước
+// nên tổng bộ nhớ không quá ~1.33 lần ảnh gốc. Mỗi bước zoom vẽ từ mức gần nhất
+// không nhỏ hơn màn hình, GPU chỉ co thêm dưới 2 lần. Texture của mỗi mức chia ô
+// PYRAMID_TILE, chỉ ô trong vùng nhìn được tải lên
+#define PYRAMID_LEVELS 16
+#define PYRAMID_TILE 1024
+#define ZOOM_STEP 1.25      // mỗi nấc con lăn chuột
+#define ZOOM_MAX 16.0
+
+// Zoom sâu hơn mức finest (ảnh giải mã theo dải): phần đang nhìn được giải mã
+// thẳng từ file nhờ chỉ mục JPEG (trạng thái bộ giải mã entropy ở đầu mỗi 32 MCU,
+// ghi vào ~/.cache/imgv lần đầu ảnh được giải mã hết), thành các ô ROI_TILE pixel
+// của mức đang xem. Mỗi frame chỉ giải mã thêm trong ROI_BUDGET_MS, chỗ chưa có
+// ô thì thấy mức finest vẽ bên dưới
+#define ROI_TILE 512
+#define ROI_BORDER 2        // như TILES_BORDER: filter tuyến tính không tạo đường nối
+#define ROI_CACHE 64
+#define ROI_BUDGET_MS 25
+
+typedef struct {
+    SDL_Texture *texture;   // NULL = ô trống
+    int level, col, row;
+    int x, y;               // góc trên trái của texture (cả viền) trên mức
+    unsigned int last_used;
+} RoiTile;
+
+typedef struct {
+    char path[4096];
+    int w, h;               // ảnh gốc; 0 = chưa có ảnh để zoom
+    int opaque;
+    int finest;             // mức chi tiết nhất được dựng: 0, trừ ảnh lớn hơn IMGV_STREAM_MB
+    unsigned char *pixels[PYRAMID_LEVELS];   // RGBA theo texture_format, NULL = chưa dựng
+    TiledTexture *textures[PYRAMID_LEVELS];
+    unsigned char *index;   // chỉ mục JPEG đọc từ cache (xem load_jpeg_index)
+    int index_len;
+    int index_state;        // 0 = chưa tìm, 1 = có, -1 = không có hoặc không dùng được
+    RoiTile roi[ROI_CACHE];
+    unsigned int roi_clock;
+    int roi_missing;        // frame vừa vẽ còn ô chưa kịp giải mã
+} Pyramid;
+
+// Texture của các ảnh vừa xem và ảnh kề (giải mã trước lúc rảnh), để chuyển ảnh
+// chỉ còn đổi texture thay vì giải mã và tải lên GPU; mỗi ảnh giữ cả ảnh nguồn.
+// Giới hạn theo bộ nhớ ước tính, biến môi trường IMGV_TEXTURE_MB (mặc định 128,
+// 0 = tắt); khi đầy, ảnh không kề ảnh hiện tại bị bỏ trước, rồi tới ảnh lâu không
+// dùng nhất
+#define TEXTURE_CACHE_SLOTS 8
+
+// Ảnh giữ lại sau khi giải mã: không nhỏ hơn ảnh vừa màn hình (hoặc là ảnh gốc nếu
+// nhỏ hơn), để dựng lại ảnh hiện cho cửa sổ cỡ khác mà không đọc lại file
+typedef struct {
+    unsigned char *pixels;  // NULL = không có (GIF động)
+    Uint32 format;
+    int w, h;
+    stbir_pixel_layout layout;
+} SourceImage;
+
+typedef struct {
+    char path[4096];        // rỗng = slot trống
+    long long size, mtime;  // của file lúc giải mã; file đổi thì không dùng lại
+    TiledTexture *texture;  // NULL = giải mã trước không được, không thử lại
+    SourceImage source;
+    size_t bytes;           // texture và ảnh nguồn
+    int img_w, img_h, win_w, win_h;
+    int opaque;
+    int preview;            // ảnh xem trước chưa làm nét xong: làm nét lại khi lấy ra
+    unsigned int last_used;
+} CachedTexture;
+
+// Ảnh đã giải mã và thu nhỏ cho cửa sổ, chưa có texture (xem decode_image)
+typedef struct {
+    unsigned char *pixels;  // data_w x data_h theo format (có thể là source.pixels); NULL với GIF động
+    Uint32 format;
+    int data_w, data_h;
+    int img_w, img_h;       // kích thước gốc
+    int win_w, win_h;       // cửa sổ vừa 90% màn hình
+    int out_w, out_h;       // cỡ ảnh hiện: vừa cửa sổ (hoặc cả cửa sổ đang toàn màn hình)
+    int opaque;
+    SourceImage source;     // giữ lại để resize cho cỡ cửa sổ khác
+    int preview;            // pixels chưa resize về out_w x out_h, GPU co giãn tới khi làm nét
+    stbi_gif_stream *gif;   // GIF động: stream và frame đầu tiên
+    const unsigned char *frame;
+    int delay;
+} DecodedImage;
+
+// Cỡ đích của lần giải mã, lấy ở luồng chính trước khi giải mã (SDL chỉ được gọi từ
+// luồng đó, còn giải mã trước chạy ở luồng nền)
+typedef struct {
+    int screen_w, screen_h; // màn hình chứa cửa sổ
+    int locked;             // cửa sổ giữ nguyên cỡ (window_size_locked)
+    int out_w, out_h;       // cỡ vẽ của renderer, khi locked
+} DecodeTarget;
+
+// Giải mã trước ảnh kề ở luồng nền, cả resize như refine_thread; luồng chính chỉ
+// tạo texture khi xong (xem prefetch_neighbors)
+typedef struct {
+    SDL_Thread *thread;     // NULL = không có ảnh đang giải mã trước
+    SDL_atomic_t done;      // luồng nền đã xong, kết quả nằm trong d
+    char path[4096];
+    DecodeTarget target;
+    DecodedImage d;
+    int ok;
+    ResizeCache resize_cache;
+} Prefetch;
+
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
-    SDL_Texture *texture;
+    int hit_test;           // cửa sổ được WM kéo qua SDL_SetWindowHitTest
+    int surface_present;    // renderer phần mềm: chỉ vẽ lại vùng thay đổi (xem present_frame)
+    int redraw;             // cần vẽ lại cả cửa sổ
+    SDL_Rect dirty;         // hoặc chỉ vùng này (w = 0: không có)
+    int fixed_window;       // IMGV_FIXED_WINDOW: cửa sổ giữ nguyên cỡ khi chuyển ảnh
+    SDL_DisplayMode display;    // màn hình chứa cửa sổ, hỏi lại khi display_valid = 0
+    int display_valid;
+    TiledTexture *texture;  // ảnh đang hiện, chia ô nếu lớn hơn giới hạn texture
+    Uint32 texture_format;  // RGBA32 hoặc BGRA32, renderer nhận trực tiếp không cần chuyển đổi
+    int yuv_textures;       // renderer có texture IYUV: JPEG được tải lên dạng Y, Cb, Cr
     int img_width, img_height;
     int win_width, win_height;
     ImageList image_list;
     char current_dir[4096];
+    stbi_gif_stream *gif;   // GIF động đang phát (NULL nếu là ảnh tĩnh)
+    Uint32 next_frame;      // SDL_GetTicks() lúc hiện frame tiếp theo
+    int gif_frames;         // số frame đã hiện từ đầu lượt phát
+    const ResizeKernels *resize;  // bản stb_image_resize2 chọn theo CPU lúc khởi động
+    ResizeCache resize_cache;   // của luồng chính và luồng làm nét (không chạy cùng lúc)
+    int refine_delay;       // ms, hoặc REFINE_SYNC / REFINE_OFF
+    Refinement refine;
+    int pool_stats;         // IMGV_POOL_STATS: in thống kê pool sau mỗi ảnh
+    size_t stream_bytes;    // JPEG lớn hơn (RGBA) được giải mã theo dải, xem show_image
+    Pyramid pyramid;
+    double zoom;            // pixel renderer / pixel ảnh gốc; 0 = vừa cửa sổ
+    double view_x, view_y;  // điểm ảnh gốc ở góc trên trái khi zoom
+    char image_path[4096];  // ảnh tĩnh đang hiện (rỗng với GIF động), để đưa vào cache
+    int image_opaque;
+    SourceImage source;     // của ảnh đang hiện
+    int target_w, target_h; // cỡ texture đang hiện, hoặc sẽ có khi làm nét xong
+    int rescale_pending;    // cửa sổ vừa đổi kích thước, resize lại lúc rescale_at
+    Uint32 rescale_at;
+    CachedTexture texture_cache[TEXTURE_CACHE_SLOTS];
+    size_t texture_budget;
+    unsigned int texture_clock;
+    Prefetch prefetch;
 } ImageViewer;
 
+// Định dạng 32-bit có alpha đầu tiên renderer liệt kê mà stb_image giải mã ra được
+// trực tiếp (RGBA hoặc BGRA theo thứ tự byte); không có thì để SDL chuyển đổi từ RGBA32
+Uint32 native_texture_format(SDL_Renderer *renderer) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+            if (info.texture_formats[i] == SDL_PIXELFORMAT_RGBA32 ||
+                info.texture_formats[i] == SDL_PIXELFORMAT_BGRA32)
+                return info.texture_formats[i];
+        }
+    }
+    return SDL_PIXELFORMAT_RGBA32;
+}
+
+// Renderer có liệt kê định dạng này không (nếu không SDL vẫn tạo được texture
+// nhưng tự chuyển đổi trên CPU mỗi lần cập nhật)
+int renderer_has_format(SDL_Renderer *renderer, Uint32 format) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+            if (info.texture_formats[i] == format)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Số byte của ảnh w x h: IYUV là Y đủ kích thước + Cb, Cr một nửa mỗi chiều
+// (1.5 byte/pixel, thứ tự như stbi_load_jpeg_yuv), còn lại 4 byte/pixel
+size_t image_bytes(Uint32 format, int w, int h) {
+    if (format == SDL_PIXELFORMAT_IYUV)
+        return (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+    return (size_t)w * h * 4;
+}
+
+// Chế độ màn hình chứa cửa sổ. Chỉ hỏi SDL lần đầu và sau khi màn hình đổi
+// (SDL_DISPLAYEVENT, cửa sổ sang màn hình khác), không phải mỗi ảnh
+const SDL_DisplayMode *display_mode(ImageViewer *viewer) {
+    if (!viewer->display_valid) {
+        int index = viewer->window ? SDL_GetWindowDisplayIndex(viewer->window) : 0;
+        if (SDL_GetCurrentDisplayMode(index < 0 ? 0 : index, &viewer->display) == 0) {
+            viewer->display_valid = 1;
+        } else {
+            fprintf(stderr, "Warning: cannot get display mode: %s\n", SDL_GetError());
+            viewer->display.w = 1920;
+            viewer->display.h = 1080;
+        }
+    }
+    return &viewer->display;
+}
+
+// Cửa sổ cố định, toàn màn hình hoặc phóng to: cỡ không đổi theo ảnh, ảnh vừa vào
+// giữa cửa sổ
+int window_size_locked(ImageViewer *viewer) {
+    return viewer->window && (viewer->fixed_window ||
+           (SDL_GetWindowFlags(viewer->window) & (SDL_WINDOW_FULLSCREEN | SDL_WINDOW_MAXIMIZED)) != 0);
+}
+
+// Kích thước lớn nhất giữ tỉ lệ w:h nằm trong max_w x max_h
+void fit_size(int w, int h, int max_w, int max_h, int *out_w, int *out_h) {
+    double scale = fmin((double)max_w / w, (double)max_h / h);
+    *out_w = (int)(w * scale + 0.5);
+    *out_h = (int)(h * scale + 0.5);
+    if (*out_w < 1) *out_w = 1;
+    if (*out_h < 1) *out_h = 1;
+    if (*out_w > max_w) *out_w = max_w;
+    if (*out_h > max_h) *out_h = max_h;
+}
+
+// Kéo chuột trái ở bất kỳ đâu trong ảnh là kéo cửa sổ: WM tự di chuyển cửa sổ,
+// imgv không nhận sự kiện nào. Khi đang zoom (kéo ảnh) hoặc toàn màn hình thì không
+SDL_HitTestResult window_hit_test(SDL_Window *window, const SDL_Point *area, void *data) {
+    ImageViewer *viewer = data;
+    (void)area;
+    if (viewer->zoom > 0 || (SDL_GetWindowFlags(window) & SDL_WINDOW_FULLSCREEN))
+        return SDL_HITTEST_NORMAL;
+    return SDL_HITTEST_DRAGGABLE;
+}
+
 // Hàm resize cửa sổ (để GNOME window manager handle positioning)
 int resize_window(ImageViewer *viewer, const char *title) {
     if (!viewer->window) {
+        // Cửa sổ cố định: 90% màn hình cho mọi ảnh
+        int w = viewer->win_width, h = viewer->win_height;
+        if (viewer->fixed_window) {
+            w = display_mode(viewer)->w * 0.9;
+            h = display_mode(viewer)->h * 0.9;
+        }
         // Tạo cửa sổ và để GNOME window manager tự quyết định vị trí
-        viewer->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                                        viewer->win_width, viewer->win_height, 
-                                        SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI);
+        viewer->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, w, h,
+                                        SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE);
         if (!viewer->window) {
             printf("Không thể tạo cửa sổ: %s\n", SDL_GetError());
             return 0;
@@ -42,24 +321,41 @@ int resize_window(ImageViewer *viewer, const char *title) {
         
         // Để GNOME window manager tự quyết định positioning
         
-        // Cho phép move nhưng sẽ control resize thông qua event handling
+        // Không có hit test (vài backend): vòng lặp chính tự kéo cửa sổ
+        viewer->hit_test = SDL_SetWindowHitTest(viewer->window, window_hit_test, viewer) == 0;
         
         viewer->renderer = SDL_CreateRenderer(viewer->window, -1, SDL_RENDERER_ACCELERATED);
+        if (!viewer->renderer) {
+            // Không có GPU (CI, VNC, thin client)
+            fprintf(stderr, "Warning: no accelerated renderer (%s), using software rendering.\n", SDL_GetError());
+            viewer->renderer = SDL_CreateRenderer(viewer->window, -1, SDL_RENDERER_SOFTWARE);
+        }
         if (!viewer->renderer) {
             printf("Không thể tạo renderer: %s\n", SDL_GetError());
             return 0;
         }
+        SDL_RendererInfo info;
+        viewer->surface_present = SDL_GetRendererInfo(viewer->renderer, &info) == 0 &&
+                                  (info.flags & SDL_RENDERER_SOFTWARE);
+        viewer->texture_format = native_texture_format(viewer->renderer);
+        viewer->yuv_textures = renderer_has_format(viewer->renderer, SDL_PIXELFORMAT_IYUV);
+        // Ảnh đầu tiên được resize trước khi có cửa sổ; kiểm tra lại theo cỡ renderer thật
+        viewer->display_valid = 0;
+        viewer->rescale_pending = 1;
+        viewer->rescale_at = SDL_GetTicks();
         
         return 1;
     }
     
-    // Cập nhật tiêu đề và kích thước cửa sổ
+    // Cập nhật tiêu đề và kích thước cửa sổ. Mỗi lần đổi cỡ là một lượt configure
+    // với WM/compositor nên bỏ qua khi cỡ không đổi hoặc cửa sổ giữ nguyên cỡ
     SDL_SetWindowTitle(viewer->window, title);
-    SDL_SetWindowSize(viewer->window, viewer->win_width, viewer->win_height);
-    
-    // Cho phép move, nhưng control resize thông qua event handling
-    
-    SDL_PumpEvents();
+    if (!window_size_locked(viewer)) {
+        int w, h;
+        SDL_GetWindowSize(viewer->window, &w, &h);
+        if (w != viewer->win_width || h != viewer->win_height)
+            SDL_SetWindowSize(viewer->window, viewer->win_width, viewer->win_height);
+    }
     
     return 1;
 }
@@ -141,67 +437,1301 @@ void free_image_list(ImageList *list) {
     list->count = 0;
 }
 
-// Tải và hiển thị ảnh
-int load_image(ImageViewer *viewer, const char *filepath) {
-    unsigned char *img_data = stbi_load(filepath, &viewer->img_width, &viewer->img_height, NULL, 4);
-    if (!img_data) {
-        printf("Không thể tải ảnh: %s\n", filepath);
+// Resize bằng sampler trong cache; chỉ dựng sampler mới khi gặp kích thước lạ.
+// cancel (có thể NULL) được kiểm tra giữa các dải; trả về 0 nếu lỗi hoặc bị hủy
+int resize_cached(ImageViewer *viewer, ResizeCache *cache, const unsigned char *input, int in_w, int in_h,
+                  unsigned char *output, int out_w, int out_h, stbir_pixel_layout layout,
+                  stbir_datatype type, SDL_atomic_t *cancel) {
+    ResizeSampler *slot = NULL;
+    ResizeSampler *victim = &cache->slots[0];
+    
+    for (int i = 0; i < RESIZE_CACHE_SIZE; i++) {
+        ResizeSampler *c = &cache->slots[i];
+        if (c->valid && c->in_w == in_w && c->in_h == in_h &&
+            c->out_w == out_w && c->out_h == out_h && c->layout == layout && c->type == type) {
+            slot = c;
+            break;
+        }
+        if (!c->valid || (victim->valid && c->last_used < victim->last_used))
+            victim = c;
+    }
+    
+    if (!slot) {
+        slot = victim;
+        if (slot->valid) {
+            viewer->resize->free_samplers(&slot->resize);
+            slot->valid = 0;
+        }
+        viewer->resize->resize_init(&slot->resize, input, in_w, in_h, 0,
+                                    output, out_w, out_h, 0, layout, type);
+        slot->splits = viewer->resize->build_samplers_with_splits(&slot->resize, RESIZE_SPLITS);
+        if (!slot->splits)
+            return 0;
+        slot->in_w = in_w;
+        slot->in_h = in_h;
+        slot->out_w = out_w;
+        slot->out_h = out_h;
+        slot->layout = layout;
+        slot->type = type;
+        slot->valid = 1;
+    }
+    
+    slot->last_used = ++cache->clock;
+    viewer->resize->set_buffer_ptrs(&slot->resize, input, 0, output, 0);
+    for (int i = 0; i < slot->splits; i++) {
+        if (cancel && SDL_AtomicGet(cancel))
+            return 0;
+        if (!viewer->resize->resize_extended_split(&slot->resize, i, 1))
+            return 0;
+    }
+    return 1;
+}
+
+// Resize ảnh theo định dạng texture. IYUV: từng mặt phẳng một kênh, giá trị Y, Cb, Cr
+// lấy trung bình trực tiếp (không qua sRGB); Cb và Cr cùng kích thước nên dùng chung sampler
+int resize_image(ImageViewer *viewer, ResizeCache *cache, Uint32 format, const unsigned char *input,
+                 int in_w, int in_h, unsigned char *output, int out_w, int out_h, stbir_pixel_layout layout,
+                 SDL_atomic_t *cancel) {
+    if (format != SDL_PIXELFORMAT_IYUV)
+        return resize_cached(viewer, cache, input, in_w, in_h, output, out_w, out_h, layout,
+                             STBIR_TYPE_UINT8_SRGB, cancel);
+    
+    for (int plane = 0; plane < 3; plane++) {
+        int iw = plane ? (in_w + 1) / 2 : in_w, ih = plane ? (in_h + 1) / 2 : in_h;
+        int ow = plane ? (out_w + 1) / 2 : out_w, oh = plane ? (out_h + 1) / 2 : out_h;
+        if (!resize_cached(viewer, cache, input, iw, ih, output, ow, oh, STBIR_1CHANNEL, STBIR_TYPE_UINT8, cancel))
+            return 0;
+        input += (size_t)iw * ih;
+        output += (size_t)ow * oh;
+    }
+    return 1;
+}
+
+// Callback đầu vào của stbir: dòng y lấy thẳng từ bộ giải mã JPEG theo dải
+const void *jpeg_stream_input(void *optional_output, const void *input_ptr, int num_pixels,
+                              int x, int y, void *context) {
+    (void)optional_output;
+    (void)input_ptr;
+    (void)num_pixels;
+    return stbi_jpeg_stream_row(context, y) + (size_t)x * 4;
+}
+
+// Resize JPEG đang giải mã theo dải: stbir đọc từng dòng qua callback, theo thứ tự
+// tăng dần, nên ảnh gốc không bao giờ nằm trọn trong bộ nhớ. Sampler không được
+// cache (ảnh cỡ này hiếm) và chỉ một dải vì bộ giải mã chỉ đi tới
+int resize_stream(ImageViewer *viewer, stbi_jpeg_stream *js, int in_w, int in_h,
+                  unsigned char *output, int out_w, int out_h) {
+    STBIR_RESIZE resize;
+    viewer->resize->resize_init(&resize, NULL, in_w, in_h, 0, output, out_w, out_h, 0,
+                                STBIR_4CHANNEL, STBIR_TYPE_UINT8_SRGB);
+    viewer->resize->set_pixel_callbacks(&resize, jpeg_stream_input, NULL);
+    viewer->resize->set_user_data(&resize, js);
+    int splits = viewer->resize->build_samplers_with_splits(&resize, 1);
+    int ok = splits && viewer->resize->resize_extended_split(&resize, 0, splits);
+    viewer->resize->free_samplers(&resize);
+    return ok;
+}
+
+// Giải phóng các sampler đã dựng
+void free_resize_cache(ImageViewer *viewer, ResizeCache *cache) {
+    for (int i = 0; i < RESIZE_CACHE_SIZE; i++) {
+        if (cache->slots[i].valid)
+            viewer->resize->free_samplers(&cache->slots[i].resize);
+        cache->slots[i].valid = 0;
+    }
+}
+
+// Kích thước mức k của pyramid (làm tròn lên như downscale_pow2)
+int level_size(int size, int k) {
+    return (int)(((long long)size + (1LL << k) - 1) >> k);
+}
+
+// Bỏ mọi mức đã dựng (texture trước, vì tile đọc từ pixels của mức)
+void free_pyramid(Pyramid *p) {
+    for (int k = 0; k < PYRAMID_LEVELS; k++) {
+        tiles_destroy(p->textures[k]);
+        pool_free(p->pixels[k]);
+    }
+    for (int i = 0; i < ROI_CACHE; i++)
+        if (p->roi[i].texture) SDL_DestroyTexture(p->roi[i].texture);
+    free(p->index);
+    memset(p, 0, sizeof(*p));
+}
+
+// File chỉ mục JPEG của ảnh trong $XDG_CACHE_HOME/imgv (mặc định ~/.cache/imgv),
+// tên là hash FNV-1a của đường dẫn thật, kích thước và mtime nên ảnh bị sửa thì
+// chỉ mục cũ không còn được dùng. create = 1: tạo thư mục nếu chưa có
+int jpeg_index_path(const char *filepath, char *out, size_t size, int create) {
+    struct stat st;
+    char dir[4096];
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (xdg && *xdg)
+        snprintf(dir, sizeof(dir), "%s/imgv", xdg);
+    else if (home && *home)
+        snprintf(dir, sizeof(dir), "%s/.cache/imgv", home);
+    else
+        return 0;
+    char *real = realpath(filepath, NULL);
+    if (!real || stat(real, &st) != 0) {
+        free(real);
+        return 0;
+    }
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const char *c = real; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    long long meta[2] = { (long long)st.st_size, (long long)st.st_mtime };
+    for (size_t i = 0; i < sizeof(meta); i++)
+        hash = (hash ^ ((const unsigned char *)meta)[i]) * 1099511628211ULL;
+    free(real);
+    
+    if (create) {
+        char *slash = strrchr(dir, '/');
+        *slash = 0;
+        mkdir(dir, 0700);   // ~/.cache có thể chưa có
+        *slash = '/';
+        mkdir(dir, 0700);
+    }
+    return snprintf(out, size, "%s/%016llx.jidx", dir, hash) < (int)size;
+}
+
+// Ghi chỉ mục của JPEG vừa giải mã hết theo dải, nếu chưa có. Ghi ra file tạm
+// rồi đổi tên để imgv khác không đọc phải file dở
+void store_jpeg_index(const char *filepath, stbi_jpeg_stream *js) {
+    char path[4096], tmp[4200];
+    if (!jpeg_index_path(filepath, path, sizeof(path), 1) || access(path, F_OK) == 0)
+        return;
+    int len;
+    void *index = stbi_jpeg_stream_index(js, &len);
+    if (!index) return;
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    int ok = f && fwrite(index, 1, len, f) == (size_t)len;
+    if (f && fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Warning: cannot write JPEG index %s\n", path);
+        unlink(tmp);
+    }
+    stbi_image_free(index);
+}
+
+// Đọc chỉ mục của ảnh trong pyramid lần đầu cần
+int load_jpeg_index(Pyramid *p) {
+    if (p->index_state) return p->index_state > 0;
+    p->index_state = -1;
+    char path[4096];
+    if (!jpeg_index_path(p->path, path, sizeof(path), 0)) return 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0 && st.st_size > 0 && st.st_size < (1 << 30)) {
+        p->index = malloc(st.st_size);
+        if (p->index && fread(p->index, 1, st.st_size, f) == (size_t)st.st_size) {
+            p->index_len = (int)st.st_size;
+            p->index_state = 1;
+        } else {
+            free(p->index);
+            p->index = NULL;
+        }
+    }
+    fclose(f);
+    return p->index_state > 0;
+}
+
+// Ảnh mới để zoom; chưa dựng mức nào. Ảnh mà bản RGBA lớn hơn IMGV_STREAM_MB
+// chỉ giữ từ mức đầu tiên vừa giới hạn đó
+void reset_pyramid(ImageViewer *viewer, const char *filepath, int w, int h, int opaque) {
+    Pyramid *p = &viewer->pyramid;
+    free_pyramid(p);
+    if (snprintf(p->path, sizeof(p->path), "%s", filepath) >= (int)sizeof(p->path))
+        return;
+    p->w = w;
+    p->h = h;
+    p->opaque = opaque;
+    while (p->finest < PYRAMID_LEVELS - 1 &&
+           (size_t)level_size(w, p->finest) * level_size(h, p->finest) * 4 > viewer->stream_bytes)
+        p->finest++;
+}
+
+// Giải mã lại ảnh gốc cho mức finest: ảnh quá lớn được resize thẳng từ JPEG giải
+// mã theo dải, còn lại stbi_load cả ảnh (không giải mã nửa kích thước)
+int load_pyramid_base(ImageViewer *viewer) {
+    Pyramid *p = &viewer->pyramid;
+    int k = p->finest, lw = level_size(p->w, k), lh = level_size(p->h, k);
+    int w, h;
+    
+    stbi_set_bgr_on_load(viewer->texture_format == SDL_PIXELFORMAT_BGRA32);
+    if (k > 0) {
+        stbi_jpeg_stream *js = stbi_jpeg_stream_open(p->path, &w, &h);
+        if (js) {
+            unsigned char *out = w == p->w && h == p->h ? pool_malloc((size_t)lw * lh * 4) : NULL;
+            int ok = out && resize_stream(viewer, js, w, h, out, lw, lh);
+            if (ok) store_jpeg_index(p->path, js);
+            stbi_jpeg_stream_close(js);
+            if (ok) {
+                p->pixels[k] = out;
+                return 1;
+            }
+            pool_free(out);
+        }
+    }
+    stbi_set_jpeg_fit_size(0, 0);
+    unsigned char *data = stbi_load(p->path, &w, &h, NULL, 4);
+    if (data && (w != p->w || h != p->h)) {
+        // File đã bị thay từ lúc hiện
+        pool_free(data);
+        data = NULL;
+    }
+    if (data && k > 0) {
+        unsigned char *small = downscale_pow2(data, w, h, w * 4, k, !p->opaque, 0, &w, &h);
+        pool_free(data);
+        data = small;
+    }
+    p->pixels[k] = data;
+    return data != NULL;
+}
+
+// Dựng mức k nếu chưa có; trả về 0 nếu không dựng được
+int build_pyramid_level(ImageViewer *viewer, int k) {
+    Pyramid *p = &viewer->pyramid;
+    if (p->pixels[k]) return 1;
+    if (k <= p->finest) return load_pyramid_base(viewer);
+    if (!build_pyramid_level(viewer, k - 1)) return 0;
+    
+    int lw = level_size(p->w, k - 1), lh = level_size(p->h, k - 1), w, h;
+    p->pixels[k] = downscale_pow2(p->pixels[k - 1], lw, lh, lw * 4, 1, !p->opaque, 0, &w, &h);
+    return p->pixels[k] != NULL;
+}
+
+// Mức 2^k nhỏ nhất mà vẫn không nhỏ hơn số pixel trên màn hình ở độ zoom
+int zoom_level(double zoom) {
+    return zoom < 1 ? (int)floor(log2(1 / zoom)) : 0;
+}
+
+// Mức pyramid để vẽ ở độ zoom: như zoom_level nhưng không chi tiết hơn finest
+int pyramid_level_for(const Pyramid *p, double zoom) {
+    int k = zoom_level(zoom);
+    if (k < p->finest) k = p->finest;
+    return k < PYRAMID_LEVELS ? k : PYRAMID_LEVELS - 1;
+}
+
+// Giữ vùng nhìn trong ảnh; chiều nào ảnh nhỏ hơn cửa sổ thì đặt ảnh ở giữa
+void clamp_view_axis(double *v, double visible, int size) {
+    if (visible >= size)
+        *v = (size - visible) / 2;
+    else if (*v < 0)
+        *v = 0;
+    else if (*v > size - visible)
+        *v = size - visible;
+}
+
+void clamp_view(ImageViewer *viewer) {
+    int ow, oh;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    clamp_view_axis(&viewer->view_x, ow / viewer->zoom, viewer->img_width);
+    clamp_view_axis(&viewer->view_y, oh / viewer->zoom, viewer->img_height);
+}
+
+// Độ zoom khi ảnh vừa cửa sổ
+double fit_zoom(ImageViewer *viewer) {
+    int ow, oh;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    double zw = (double)ow / viewer->img_width, zh = (double)oh / viewer->img_height;
+    return zw < zh ? zw : zh;
+}
+
+double current_zoom(ImageViewer *viewer) {
+    return viewer->zoom > 0 ? viewer->zoom : fit_zoom(viewer);
+}
+
+// Chỗ vẽ cả ảnh khi không zoom: vừa renderer, giữ tỉ lệ, ở giữa
+SDL_FRect fit_rect(ImageViewer *viewer) {
+    int ow, oh;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    double zoom = fit_zoom(viewer);
+    SDL_FRect r;
+    r.w = (float)(viewer->img_width * zoom);
+    r.h = (float)(viewer->img_height * zoom);
+    r.x = (float)((ow - r.w) / 2);
+    r.y = (float)((oh - r.h) / 2);
+    return r;
+}
+
+// Tọa độ cửa sổ (chuột) -> pixel renderer (khác nhau trên màn hình HiDPI)
+void window_to_output(ImageViewer *viewer, double *x, double *y) {
+    int ww, wh, ow, oh;
+    SDL_GetWindowSize(viewer->window, &ww, &wh);
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    if (ww > 0) *x = *x * ow / ww;
+    if (wh > 0) *y = *y * oh / wh;
+}
+
+// Zoom tới độ zoom, giữ nguyên điểm ảnh dưới (ax, ay) (pixel renderer). Nhỏ hơn
+// hoặc bằng vừa cửa sổ thì về chế độ vừa cửa sổ. GIF động không zoom
+void zoom_at(ImageViewer *viewer, double zoom, double ax, double ay) {
+    Pyramid *p = &viewer->pyramid;
+    if (viewer->gif || !p->w) return;
+    double fit = fit_zoom(viewer);
+    if (zoom > ZOOM_MAX) zoom = ZOOM_MAX;
+    if (zoom <= fit * 1.001) {
+        viewer->zoom = 0;
+        return;
+    }
+    if (viewer->zoom <= 0) {
+        viewer->zoom = fit;
+        clamp_view(viewer);
+    }
+    if (!build_pyramid_level(viewer, pyramid_level_for(p, zoom))) {
+        printf("Không thể phóng to ảnh: %s\n", p->path);
+        viewer->zoom = 0;
+        return;
+    }
+    double ix = viewer->view_x + ax / viewer->zoom, iy = viewer->view_y + ay / viewer->zoom;
+    viewer->zoom = zoom;
+    viewer->view_x = ix - ax / zoom;
+    viewer->view_y = iy - ay / zoom;
+    clamp_view(viewer);
+}
+
+// Kéo ảnh đang zoom (dx, dy pixel renderer)
+void pan_view(ImageViewer *viewer, double dx, double dy) {
+    if (viewer->zoom <= 0) return;
+    viewer->view_x -= dx / viewer->zoom;
+    viewer->view_y -= dy / viewer->zoom;
+    clamp_view(viewer);
+}
+
+// Giải mã ô (col, row) của mức k < finest từ file qua chỉ mục, cả viền, rồi tải
+// lên texture thế chỗ ô dùng lâu nhất. Chỉ mục không khớp file thì bỏ chỉ mục,
+// và xóa luôn file cache để lần giải mã theo dải sau ghi lại chỉ mục đúng
+RoiTile *decode_roi_tile(ImageViewer *viewer, int k, int col, int row) {
+    Pyramid *p = &viewer->pyramid;
+    int lw = level_size(p->w, k), lh = level_size(p->h, k);
+    int x0 = col * ROI_TILE - ROI_BORDER, y0 = row * ROI_TILE - ROI_BORDER;
+    int x1 = (col + 1) * ROI_TILE + ROI_BORDER, y1 = (row + 1) * ROI_TILE + ROI_BORDER;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > lw) x1 = lw;
+    if (y1 > lh) y1 = lh;
+    // Cùng vùng trên ảnh gốc; downscale_pow2 làm tròn lên như level_size
+    int sx = x0 << k, sy = y0 << k;
+    int sw = ((long long)x1 << k < p->w ? x1 << k : p->w) - sx;
+    int sh = ((long long)y1 << k < p->h ? y1 << k : p->h) - sy;
+    
+    stbi_set_bgr_on_load(viewer->texture_format == SDL_PIXELFORMAT_BGRA32);
+    unsigned char *pixels = stbi_jpeg_load_region(p->path, p->index, p->index_len, sx, sy, sw, sh);
+    if (!pixels) {
+        const char *reason = stbi_failure_reason();
+        fprintf(stderr, "Warning: cannot decode region of %s: %s\n", p->path, reason);
+        char path[4096];
+        if (reason && strcmp(reason, "bad index") == 0 && jpeg_index_path(p->path, path, sizeof(path), 0))
+            unlink(path);
+        free(p->index);
+        p->index = NULL;
+        p->index_state = -1;
+        return NULL;
+    }
+    int w = sw, h = sh;
+    if (k > 0) {
+        unsigned char *small = downscale_pow2(pixels, sw, sh, sw * 4, k, 0, 0, &w, &h);
+        pool_free(pixels);
+        pixels = small;
+        if (!pixels) return NULL;
+    }
+    
+    RoiTile *t = &p->roi[0];
+    for (int i = 0; i < ROI_CACHE; i++) {
+        if (!p->roi[i].texture) {
+            t = &p->roi[i];
+            break;
+        }
+        if (p->roi[i].last_used < t->last_used) t = &p->roi[i];
+    }
+    if (t->texture) SDL_DestroyTexture(t->texture);
+    memset(t, 0, sizeof(*t));
+    t->texture = SDL_CreateTexture(viewer->renderer, viewer->texture_format, SDL_TEXTUREACCESS_STATIC, w, h);
+    if (t->texture) {
+        SDL_SetTextureScaleMode(t->texture, SDL_ScaleModeLinear);
+        SDL_UpdateTexture(t->texture, NULL, pixels, w * 4);
+    } else {
+        fprintf(stderr, "Warning: cannot create %dx%d region texture: %s\n", w, h, SDL_GetError());
+    }
+    pool_free(pixels);
+    if (!t->texture) return NULL;
+    t->level = k;
+    t->col = col;
+    t->row = row;
+    t->x = x0;
+    t->y = y0;
+    return t;
+}
+
+// Vẽ vùng đang nhìn ở mức k < finest bằng các ô giải mã từ file, đè lên mức
+// finest đã vẽ. Ô chưa có được giải mã tới hết ROI_BUDGET_MS của frame, phần
+// còn lại để các frame sau (roi_missing)
+void draw_roi(ImageViewer *viewer, int k) {
+    Pyramid *p = &viewer->pyramid;
+    p->roi_missing = 0;
+    if (!load_jpeg_index(p)) return;
+    
+    int ow, oh;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    int lw = level_size(p->w, k), lh = level_size(p->h, k);
+    double level = (double)(1 << k), scale = viewer->zoom * level;
+    double x0 = viewer->view_x / level, y0 = viewer->view_y / level;
+    int c0 = x0 > 0 ? (int)(x0 / ROI_TILE) : 0, r0 = y0 > 0 ? (int)(y0 / ROI_TILE) : 0;
+    int c1 = (int)((x0 + ow / scale) / ROI_TILE), r1 = (int)((y0 + oh / scale) / ROI_TILE);
+    if (c1 > (lw - 1) / ROI_TILE) c1 = (lw - 1) / ROI_TILE;
+    if (r1 > (lh - 1) / ROI_TILE) r1 = (lh - 1) / ROI_TILE;
+    
+    Uint32 deadline = SDL_GetTicks() + ROI_BUDGET_MS;
+    for (int row = r0; row <= r1; row++) {
+        for (int col = c0; col <= c1; col++) {
+            RoiTile *t = NULL;
+            for (int i = 0; i < ROI_CACHE && !t; i++) {
+                RoiTile *c = &p->roi[i];
+                if (c->texture && c->level == k && c->col == col && c->row == row) t = c;
+            }
+            if (!t) {
+                if (!p->index) return;
+                if (SDL_TICKS_PASSED(SDL_GetTicks(), deadline)) {
+                    p->roi_missing = 1;
+                    continue;
+                }
+                if (!(t = decode_roi_tile(viewer, k, col, row))) continue;
+            }
+            t->last_used = ++p->roi_clock;
+            int tx = col * ROI_TILE, ty = row * ROI_TILE;
+            SDL_Rect from = { tx - t->x, ty - t->y, lw - tx < ROI_TILE ? lw - tx : ROI_TILE,
+                              lh - ty < ROI_TILE ? lh - ty : ROI_TILE };
+            SDL_FRect to = { (float)((tx - x0) * scale), (float)((ty - y0) * scale),
+                             (float)(from.w * scale), (float)(from.h * scale) };
+            SDL_RenderCopyF(viewer->renderer, t->texture, &from, &to);
+        }
+    }
+}
+
+// Vẽ vùng đang nhìn từ mức pyramid hợp với độ zoom. Vùng nguồn được nới ra
+// nguyên pixel của mức, phần thừa nằm ngoài renderer nên kéo mượt từng pixel màn hình
+void draw_zoomed(ImageViewer *viewer) {
+    Pyramid *p = &viewer->pyramid;
+    int k = pyramid_level_for(p, viewer->zoom);
+    if (!build_pyramid_level(viewer, k)) return;
+    int lw = level_size(p->w, k), lh = level_size(p->h, k);
+    if (!p->textures[k]) {
+        p->textures[k] = tiles_create(viewer->renderer, viewer->texture_format, SDL_TEXTUREACCESS_STATIC,
+                                      lw, lh, PYRAMID_TILE);
+        if (!p->textures[k]) return;
+        tiles_set_scale_mode(p->textures[k], SDL_ScaleModeLinear);
+        tiles_set_pixels(p->textures[k], p->pixels[k], 0);
+    }
+    
+    int ow, oh;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    double level = (double)(1 << k), scale = viewer->zoom * level;   // pixel renderer / pixel của mức
+    double x0 = viewer->view_x / level, y0 = viewer->view_y / level;
+    int sx0 = x0 > 0 ? (int)floor(x0) : 0, sy0 = y0 > 0 ? (int)floor(y0) : 0;
+    int sx1 = (int)ceil(x0 + ow / scale), sy1 = (int)ceil(y0 + oh / scale);
+    if (sx1 > lw) sx1 = lw;
+    if (sy1 > lh) sy1 = lh;
+    if (sx1 <= sx0 || sy1 <= sy0) return;
+    
+    SDL_Rect src = { sx0, sy0, sx1 - sx0, sy1 - sy0 };
+    SDL_FRect dst = { (float)((sx0 - x0) * scale), (float)((sy0 - y0) * scale),
+                      (float)(src.w * scale), (float)(src.h * scale) };
+    tiles_draw(p->textures[k], &src, &dst);
+    
+    if (zoom_level(viewer->zoom) < p->finest)
+        draw_roi(viewer, zoom_level(viewer->zoom));
+}
+
+// Vẽ ảnh (hoặc vùng đang zoom) lên nền đen
+void draw_frame(ImageViewer *viewer) {
+    if (viewer->zoom > 0) {
+        draw_zoomed(viewer);
+    } else if (viewer->texture) {
+        // Trong lúc kéo cỡ cửa sổ GPU co giãn ảnh đang có (filter tuyến tính)
+        SDL_FRect fit = fit_rect(viewer);
+        tiles_draw(viewer->texture, NULL, &fit);
+    }
+}
+
+// Vẽ và đưa frame lên cửa sổ. Renderer phần mềm vẽ thẳng vào surface của cửa sổ:
+// thay vì vẽ lại và SDL_RenderPresent cả cửa sổ mỗi frame, chỉ vẽ lại vùng thay
+// đổi (không có thì thôi) rồi đưa đúng vùng đó lên bằng SDL_UpdateWindowSurfaceRects,
+// nên ảnh đứng yên không tốn gì và frame GIF chỉ tốn phần frame đó đổi
+void present_frame(ImageViewer *viewer) {
+    SDL_SetRenderDrawColor(viewer->renderer, 0, 0, 0, 255);
+    if (!viewer->surface_present) {
+        SDL_RenderClear(viewer->renderer);
+        draw_frame(viewer);
+        SDL_RenderPresent(viewer->renderer);
+        return;
+    }
+    
+    int ow, oh;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    SDL_Rect all = { 0, 0, ow, oh }, area;
+    if (viewer->redraw)
+        area = all;
+    else if (!SDL_IntersectRect(&viewer->dirty, &all, &area))
+        return;
+    viewer->redraw = 0;
+    viewer->dirty.w = 0;
+    
+    // SDL_RenderClear bỏ qua clip rect nên tô nền bằng FillRect
+    SDL_RenderSetClipRect(viewer->renderer, &area);
+    SDL_RenderFillRect(viewer->renderer, &area);
+    draw_frame(viewer);
+    SDL_RenderSetClipRect(viewer->renderer, NULL);
+    // Lệnh vẽ được gom lại tới lúc present; đẩy xuống surface trước khi đưa lên
+    SDL_RenderFlush(viewer->renderer);
+    if (SDL_UpdateWindowSurfaceRects(viewer->window, &area, 1) != 0)
+        SDL_RenderPresent(viewer->renderer);
+}
+
+// Đọc IMGV_REFINE
+int parse_refine_mode(const char *value) {
+    if (!value || !*value) return 0;
+    if (strcmp(value, "off") == 0) return REFINE_OFF;
+    if (strcmp(value, "sync") == 0) return REFINE_SYNC;
+    int delay = atoi(value);
+    return delay > 0 ? delay : 0;
+}
+
+// Luồng nền: resize chất lượng cao ảnh đang xem trước
+int refine_thread(void *data) {
+    ImageViewer *viewer = data;
+    Refinement *r = &viewer->refine;
+    r->ok = resize_image(viewer, &viewer->resize_cache, r->format, r->src, r->src_w, r->src_h,
+                         r->out, r->out_w, r->out_h, r->layout, &r->cancel);
+    SDL_AtomicSet(&r->done, 1);
+    return 0;
+}
+
+// Hủy lần làm nét đang chờ hoặc đang chạy (chờ luồng nền dừng ở dải hiện tại)
+void cancel_refinement(ImageViewer *viewer) {
+    Refinement *r = &viewer->refine;
+    if (r->thread) {
+        SDL_AtomicSet(&r->cancel, 1);
+        SDL_WaitThread(r->thread, NULL);
+        r->thread = NULL;
+    }
+    pool_free(r->out);
+    r->src = NULL;
+    r->out = NULL;
+    r->pending = 0;
+}
+
+// Gọi mỗi vòng lặp: bắt đầu làm nét khi tới giờ, thay texture khi luồng nền xong
+void update_refinement(ImageViewer *viewer) {
+    Refinement *r = &viewer->refine;
+    if (!r->pending) return;
+    
+    if (!r->thread) {
+        if (!SDL_TICKS_PASSED(SDL_GetTicks(), r->start_at)) return;
+        r->out = pool_malloc(image_bytes(r->format, r->out_w, r->out_h));
+        SDL_AtomicSet(&r->cancel, 0);
+        SDL_AtomicSet(&r->done, 0);
+        if (r->out)
+            r->thread = SDL_CreateThread(refine_thread, "imgv-refine", viewer);
+        if (!r->thread) {
+            fprintf(stderr, "Warning: cannot start background resize, keeping preview.\n");
+            cancel_refinement(viewer);
+            viewer->target_w = viewer->texture->w;
+            viewer->target_h = viewer->texture->h;
+        }
+        return;
+    }
+    
+    if (!SDL_AtomicGet(&r->done)) return;
+    SDL_WaitThread(r->thread, NULL);
+    r->thread = NULL;
+    
+    // Thay texture giữa hai lần vẽ nên không nhấp nháy; các tile nhận luôn bộ đệm
+    // kết quả và tải lên khi vẽ
+    TiledTexture *texture = NULL;
+    if (r->ok) {
+        texture = tiles_create(viewer->renderer, r->format, SDL_TEXTUREACCESS_STATIC,
+                               r->out_w, r->out_h, 0);
+    }
+    if (texture) {
+        tiles_set_scale_mode(texture, SDL_ScaleModeLinear);
+        tiles_set_pixels(texture, r->out, 1);
+        r->out = NULL;
+        tiles_destroy(viewer->texture);
+        viewer->texture = texture;
+        viewer->redraw = 1;
+    }
+    cancel_refinement(viewer);
+    viewer->target_w = viewer->texture->w;
+    viewer->target_h = viewer->texture->h;
+}
+
+// Làm nét ảnh nguồn của ảnh đang hiện về out_w x out_h sau delay ms
+void start_refinement(ImageViewer *viewer, int out_w, int out_h, int delay) {
+    Refinement *r = &viewer->refine;
+    r->src = viewer->source.pixels;
+    r->src_w = viewer->source.w;
+    r->src_h = viewer->source.h;
+    r->layout = viewer->source.layout;
+    r->format = viewer->source.format;
+    r->out_w = out_w;
+    r->out_h = out_h;
+    r->start_at = SDL_GetTicks() + delay;
+    r->pending = 1;
+    viewer->target_w = out_w;
+    viewer->target_h = out_h;
+}
+
+// Cửa sổ đã thôi đổi kích thước: resize lại ảnh nguồn cho vừa cỡ mới ở luồng nền
+// như lần làm nét, không đọc lại file. Trong lúc chờ GPU vẫn co giãn texture cũ
+void rescale_to_window(ImageViewer *viewer) {
+    viewer->rescale_pending = 0;
+    SourceImage *s = &viewer->source;
+    if (!s->pixels || !viewer->texture || viewer->refine_delay == REFINE_OFF) return;
+    
+    int ow, oh, w, h;
+    SDL_GetRendererOutputSize(viewer->renderer, &ow, &oh);
+    fit_size(viewer->img_width, viewer->img_height, ow, oh, &w, &h);
+    if (w > s->w || h > s->h) {
+        // Không có gì chi tiết hơn ảnh nguồn: phần còn lại để GPU phóng to
+        w = s->w;
+        h = s->h;
+    }
+    if (abs(w - viewer->target_w) <= 1 && abs(h - viewer->target_h) <= 1) return;
+    
+    cancel_refinement(viewer);
+    if (w == s->w && h == s->h) {
+        TiledTexture *texture = tiles_create(viewer->renderer, s->format, SDL_TEXTUREACCESS_STATIC, w, h, 0);
+        if (!texture) return;
+        tiles_set_scale_mode(texture, SDL_ScaleModeLinear);
+        tiles_set_pixels(texture, s->pixels, 0);
+        tiles_destroy(viewer->texture);
+        viewer->texture = texture;
+        viewer->redraw = 1;
+        viewer->target_w = w;
+        viewer->target_h = h;
+        return;
+    }
+    start_refinement(viewer, w, h, 0);
+}
+
+// Cửa sổ đổi kích thước (kéo mép, phóng to, toàn màn hình)
+void window_resized(ImageViewer *viewer) {
+    viewer->rescale_pending = 1;
+    viewer->rescale_at = SDL_GetTicks() + RESCALE_SETTLE_MS;
+    if (viewer->zoom > 0)
+        clamp_view(viewer);
+}
+
+// Bật/tắt toàn màn hình (theo độ phân giải đang dùng của màn hình)
+void toggle_fullscreen(ImageViewer *viewer) {
+    int on = (SDL_GetWindowFlags(viewer->window) & SDL_WINDOW_FULLSCREEN) != 0;
+    if (SDL_SetWindowFullscreen(viewer->window, on ? 0 : SDL_WINDOW_FULLSCREEN_DESKTOP) != 0)
+        fprintf(stderr, "Warning: cannot toggle fullscreen: %s\n", SDL_GetError());
+}
+
+// Vùng renderer phải vẽ lại ở frame sau (chỉ có nghĩa khi surface_present)
+void mark_dirty(ImageViewer *viewer, const SDL_Rect *area) {
+    if (viewer->dirty.w > 0 && viewer->dirty.h > 0)
+        SDL_UnionRect(&viewer->dirty, area, &viewer->dirty);
+    else
+        viewer->dirty = *area;
+}
+
+// Dừng phát GIF động hiện tại
+void stop_animation(ImageViewer *viewer) {
+    if (viewer->gif) {
+        stbi_gif_stream_close(viewer->gif);
+        viewer->gif = NULL;
+    }
+}
+
+// Delay của frame GIF; giống trình duyệt, delay <= 10ms được hiểu là 100ms
+int gif_frame_delay(int delay_ms) {
+    return delay_ms <= 10 ? 100 : delay_ms;
+}
+
+// Hiện frame tiếp theo của GIF động khi đến giờ, chỉ tải lên vùng thay đổi
+void advance_animation(ImageViewer *viewer) {
+    Uint32 now = SDL_GetTicks();
+    if (!viewer->gif || !SDL_TICKS_PASSED(now, viewer->next_frame)) return;
+    
+    int delay, rect[4];
+    const unsigned char *frame = stbi_gif_stream_next(viewer->gif, &delay, rect);
+    if (!frame) {
+        // Hết ảnh (hoặc phần sau bị hỏng): phát lại từ đầu nếu có nhiều hơn một frame
+        if (viewer->gif_frames > 1 && stbi_gif_stream_rewind(viewer->gif))
+            frame = stbi_gif_stream_next(viewer->gif, &delay, rect);
+        if (!frame) {
+            stop_animation(viewer);
+            return;
+        }
+        viewer->gif_frames = 0;
+    }
+    viewer->gif_frames++;
+    
+    if (rect[2] > 0 && rect[3] > 0) {
+        SDL_Rect r = { rect[0], rect[1], rect[2], rect[3] };
+        tiles_update(viewer->texture, &r, frame, viewer->img_width * 4);
+        // Vùng đó trên cửa sổ, nới một pixel cho filter tuyến tính
+        SDL_FRect fit = fit_rect(viewer);
+        double sx = fit.w / viewer->img_width, sy = fit.h / viewer->img_height;
+        int x0 = (int)floor(fit.x + r.x * sx) - 1, y0 = (int)floor(fit.y + r.y * sy) - 1;
+        int x1 = (int)ceil(fit.x + (r.x + r.w) * sx) + 1, y1 = (int)ceil(fit.y + (r.y + r.h) * sy) + 1;
+        SDL_Rect area = { x0, y0, x1 - x0, y1 - y0 };
+        mark_dirty(viewer, &area);
+    }
+    
+    // Giữ đúng nhịp; nếu đã trễ hơn một frame thì tính lại từ bây giờ
+    viewer->next_frame += gif_frame_delay(delay);
+    if (SDL_TICKS_PASSED(now, viewer->next_frame))
+        viewer->next_frame = now + gif_frame_delay(delay);
+}
+
+int file_signature(const char *path, long long *size, long long *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return 1;
+}
+
+// Đường dẫn ảnh thứ index (tính vòng) trong danh sách; 0 nếu quá dài
+int image_list_path(ImageViewer *viewer, int index, char *out, size_t size) {
+    int count = viewer->image_list.count;
+    if (count == 0) return 0;
+    index = (index % count + count) % count;
+    int n = snprintf(out, size, "%s/%s", viewer->current_dir, viewer->image_list.files[index]);
+    return n >= 0 && (size_t)n < size;
+}
+
+// Ảnh hiện tại hoặc ngay trước, ngay sau nó trong danh sách
+int is_neighbor(ImageViewer *viewer, const char *path) {
+    char p[4096];
+    for (int step = -1; step <= 1; step++) {
+        if (image_list_path(viewer, viewer->image_list.current + step, p, sizeof(p)) && strcmp(p, path) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void free_source(SourceImage *s) {
+    pool_free(s->pixels);
+    memset(s, 0, sizeof(*s));
+}
+
+void drop_cached_texture(CachedTexture *c) {
+    tiles_destroy(c->texture);
+    free_source(&c->source);
+    memset(c, 0, sizeof(*c));
+}
+
+void free_texture_cache(ImageViewer *viewer) {
+    for (int i = 0; i < TEXTURE_CACHE_SLOTS; i++)
+        drop_cached_texture(&viewer->texture_cache[i]);
+}
+
+// Slot của ảnh trong cache, NULL nếu không có; slot của file đã bị sửa được bỏ luôn
+CachedTexture *find_cached_texture(ImageViewer *viewer, const char *path) {
+    for (int i = 0; i < TEXTURE_CACHE_SLOTS; i++) {
+        CachedTexture *c = &viewer->texture_cache[i];
+        if (!c->path[0] || strcmp(c->path, path) != 0) continue;
+        long long size, mtime;
+        if (file_signature(path, &size, &mtime) && size == c->size && mtime == c->mtime)
+            return c;
+        drop_cached_texture(c);
+        return NULL;
+    }
+    return NULL;
+}
+
+// Lấy texture của ảnh ra khỏi cache (vào *out); 0 nếu không có
+int take_cached_texture(ImageViewer *viewer, const char *path, CachedTexture *out) {
+    CachedTexture *c = find_cached_texture(viewer, path);
+    if (!c) return 0;
+    if (!c->texture) {
+        // Lần này giải mã như thường, có báo lỗi
+        drop_cached_texture(c);
         return 0;
     }
+    *out = *c;
+    memset(c, 0, sizeof(*c));
+    return 1;
+}
+
+// Đưa texture t và ảnh nguồn *source của ảnh path vào cache (t = NULL: đánh dấu
+// không giải mã trước được), tải lên GPU hết các tile còn chờ. Bỏ ảnh khác tới khi
+// đủ chỗ; ảnh lớn hơn cả ngân sách thì hủy luôn
+void cache_texture(ImageViewer *viewer, const char *path, TiledTexture *t, SourceImage *source,
+                   int img_w, int img_h, int win_w, int win_h, int opaque, int preview) {
+    long long size, mtime;
+    size_t bytes = t ? image_bytes(t->format, t->w, t->h) : 0;
+    if (source->pixels) bytes += image_bytes(source->format, source->w, source->h);
+    if (t) tiles_upload_all(t);
+    if (!viewer->texture_budget || bytes > viewer->texture_budget ||
+        strlen(path) >= sizeof(viewer->texture_cache[0].path) || !file_signature(path, &size, &mtime)) {
+        tiles_destroy(t);
+        free_source(source);
+        return;
+    }
     
+    for (;;) {
+        size_t used = bytes;
+        CachedTexture *slot = NULL, *victim = NULL;
+        int victim_near = 0;
+        for (int i = 0; i < TEXTURE_CACHE_SLOTS; i++) {
+            CachedTexture *c = &viewer->texture_cache[i];
+            if (!c->path[0]) {
+                if (!slot) slot = c;
+                continue;
+            }
+            used += c->bytes;
+            int near = is_neighbor(viewer, c->path);
+            if (!victim || near < victim_near || (near == victim_near && c->last_used < victim->last_used)) {
+                victim = c;
+                victim_near = near;
+            }
+        }
+        if (slot && used <= viewer->texture_budget) {
+            snprintf(slot->path, sizeof(slot->path), "%s", path);
+            slot->size = size;
+            slot->mtime = mtime;
+            slot->texture = t;
+            slot->source = *source;
+            memset(source, 0, sizeof(*source));
+            slot->bytes = bytes;
+            slot->img_w = img_w;
+            slot->img_h = img_h;
+            slot->win_w = win_w;
+            slot->win_h = win_h;
+            slot->opaque = opaque;
+            slot->preview = preview;
+            slot->last_used = ++viewer->texture_clock;
+            return;
+        }
+        drop_cached_texture(victim);
+    }
+}
+
+// Bỏ texture và ảnh nguồn đang hiện: ảnh tĩnh vào cache (preview = 1: texture còn
+// là ảnh xem trước, lần làm nét bị hủy giữa chừng), còn lại hủy
+void retire_texture(ImageViewer *viewer, int preview) {
+    if (viewer->texture && viewer->image_path[0]) {
+        cache_texture(viewer, viewer->image_path, viewer->texture, &viewer->source, viewer->img_width,
+                      viewer->img_height, viewer->win_width, viewer->win_height, viewer->image_opaque,
+                      preview);
+    } else {
+        tiles_destroy(viewer->texture);
+        free_source(&viewer->source);
+    }
+    viewer->texture = NULL;
+    viewer->image_path[0] = '\0';
+}
+
+void free_decoded(DecodedImage *d) {
+    if (d->pixels != d->source.pixels) pool_free(d->pixels);
+    d->pixels = NULL;
+    free_source(&d->source);
+    if (d->gif) stbi_gif_stream_close(d->gif);
+    d->gif = NULL;
+}
+
+// Cỡ đích cho lần giải mã tới (ở luồng chính)
+void decode_target(ImageViewer *viewer, DecodeTarget *target) {
+    const SDL_DisplayMode *dm = display_mode(viewer);
+    target->screen_w = dm->w;
+    target->screen_h = dm->h;
+    target->locked = window_size_locked(viewer);
+    target->out_w = target->out_h = 0;
+    if (target->locked)
+        SDL_GetRendererOutputSize(viewer->renderer, &target->out_w, &target->out_h);
+}
+
+// Giải mã ảnh và resize về kích thước cửa sổ theo target; ảnh trước bước resize cuối
+// (vừa cả màn hình trở lên) được giữ làm ảnh nguồn. prefetch = 1 (giải mã trước ảnh
+// kề, ở luồng nền): resize chất lượng cao ngay bằng sampler riêng, bỏ qua GIF động
+// và không in lỗi. Không gọi SDL
+int decode_image(ImageViewer *viewer, const char *filepath, const DecodeTarget *target,
+                 DecodedImage *d, int prefetch) {
     // Tính toán kích thước cửa sổ phù hợp
-    SDL_DisplayMode dm;
-    SDL_GetCurrentDisplayMode(0, &dm);
-    int screen_w = dm.w * 0.9; // 90% màn hình
-    int screen_h = dm.h * 0.9;
-    
-    viewer->win_width = viewer->img_width;
-    viewer->win_height = viewer->img_height;
-    
-    // Nếu ảnh quá lớn, resize
-    if (viewer->win_width > screen_w || viewer->win_height > screen_h) {
-        float scale_w = (float)screen_w / viewer->img_width;
-        float scale_h = (float)screen_h / viewer->img_height;
+    int screen_w = target->screen_w * 0.9; // 90% màn hình
+    int screen_h = target->screen_h * 0.9;
+    
+    memset(d, 0, sizeof(*d));
+    // Giải mã thẳng ra thứ tự byte của texture (JPEG/GIF đảo R, B ngay lúc chuyển màu);
+    // box filter và stbir không phân biệt thứ tự kênh nên cả đường resize giữ nguyên
+    // thứ tự đó và SDL_UpdateTexture không phải chuyển đổi từng pixel. Ảnh đầu tiên
+    // được giải mã trước khi có renderer nên vẫn là RGBA32
+    Uint32 format = viewer->texture_format;
+    stbi_set_bgr_on_load(format == SDL_PIXELFORMAT_BGRA32);
+    
+    // Kích thước gốc; JPEG cần thu nhỏ >= 2 lần được giải mã ở nửa kích thước
+    // (data_w x data_h) để bỏ bước upsample chroma
+    int img_w, img_h, data_w, data_h;
+    int comp = 4;   // số kênh trong file; 1 hoặc 3 = chắc chắn không có alpha
+    unsigned char *img_data = NULL;
+    stbi_jpeg_stream *stream = NULL;
+    
+    // GIF được giải mã từng frame; chỉ giữ stream lại nếu còn frame tiếp theo.
+    // Xem chữ ký "GIF8" trước: mở stream tốn thêm một lần fopen và bộ đệm ~35 KB,
+    // còn file đã mở ở đây dùng luôn cho stbi_info của các định dạng khác
+    const unsigned char *frame = NULL;
+    int delay = 0;
+    FILE *f = fopen(filepath, "rb");
+    if (!f) {
+        if (!prefetch) printf("Không thể tải ảnh: %s\n", filepath);
+        return 0;
+    }
+    unsigned char sig[4];
+    stbi_gif_stream *gif = NULL;
+    if (fread(sig, 1, sizeof(sig), f) == sizeof(sig) && memcmp(sig, "GIF8", 4) == 0)
+        gif = stbi_gif_stream_open(filepath, &img_w, &img_h);
+    if (gif) {
+        fclose(f);
+        frame = stbi_gif_stream_next(gif, &delay, NULL);
+        if (frame && !stbi_gif_stream_more(gif)) {
+            // GIF tĩnh: hiển thị như ảnh thường
+            img_data = pool_malloc((size_t)img_w * img_h * 4);
+            if (img_data) memcpy(img_data, frame, (size_t)img_w * img_h * 4);
+            data_w = img_w;
+            data_h = img_h;
+            stbi_gif_stream_close(gif);
+            gif = NULL;
+        } else if (!frame || prefetch) {
+            stbi_gif_stream_close(gif);
+            gif = NULL;
+            if (prefetch) return 0;
+        }
+    } else {
+        stbi_set_jpeg_fit_size(target->screen_w, target->screen_h);
+        fseek(f, 0, SEEK_SET);
+        int ok = stbi_info_from_file(f, &img_w, &img_h, &comp);
+        fclose(f);
+        if (ok) {
+            // JPEG quá lớn để giải mã cả ảnh: giải mã theo dải ngay trong lúc resize,
+            // bộ nhớ chỉ cần ảnh đích và vài hàng MCU. JPEG progressive và các định
+            // dạng khác cần cả ảnh nên vẫn đi đường thường
+            if ((size_t)img_w * img_h * 4 > viewer->stream_bytes)
+                stream = stbi_jpeg_stream_open(filepath, &data_w, &data_h);
+            // JPEG YCbCr/xám: giữ nguyên Y, Cb, Cr (chroma 4:2:0) cho texture IYUV, GPU
+            // chuyển màu lúc vẽ; CPU bỏ bước chuyển màu và chỉ tải lên 1.5 byte/pixel.
+            // File không hợp (PNG, JPEG CMYK...) trả về NULL ngay sau header
+            if (!stream && viewer->yuv_textures) {
+                img_data = stbi_load_jpeg_yuv(filepath, &data_w, &data_h);
+                if (img_data) format = SDL_PIXELFORMAT_IYUV;
+            }
+            if (!stream && !img_data)
+                img_data = stbi_load(filepath, &data_w, &data_h, NULL, 4);
+        }
+    }
+    if (!img_data && !gif && !stream) {
+        if (!prefetch) printf("Không thể tải ảnh: %s\n", filepath);
+        return 0;
+    }
+    
+    int win_w = img_w, win_h = img_h;
+    // Nếu ảnh quá lớn, tính kích thước thu nhỏ
+    if (win_w > screen_w || win_h > screen_h) {
+        float scale_w = (float)screen_w / img_w;
+        float scale_h = (float)screen_h / img_h;
         float scale = (scale_w < scale_h) ? scale_w : scale_h;
         
-        viewer->win_width = (int)(viewer->img_width * scale);
-        viewer->win_height = (int)(viewer->img_height * scale);
-        
-        // Resize ảnh
-        unsigned char *resized_data = malloc(viewer->win_width * viewer->win_height * 4);
-        stbir_resize_uint8_srgb(img_data, viewer->img_width, viewer->img_height, 0,
-                              resized_data, viewer->win_width, viewer->win_height, 0, 4);
-        stbi_image_free(img_data);
-        img_data = resized_data;
+        win_w = (int)(img_w * scale);
+        win_h = (int)(img_h * scale);
+    }
+    // Ảnh nguồn giữ lại không nhỏ hơn ảnh vừa cả màn hình, để cửa sổ phóng to hay
+    // toàn màn hình vẫn nét
+    int full_w = img_w, full_h = img_h;
+    if (img_w > target->screen_w || img_h > target->screen_h)
+        fit_size(img_w, img_h, target->screen_w, target->screen_h, &full_w, &full_h);
+    // Ảnh hiện vừa cửa sổ mới; cửa sổ giữ nguyên cỡ thì vừa cỡ đó (không lớn hơn ảnh gốc)
+    int out_w = win_w, out_h = win_h;
+    if (target->locked) {
+        fit_size(img_w, img_h, target->out_w, target->out_h, &out_w, &out_h);
+        if (out_w > full_w || out_h > full_h) {
+            out_w = full_w;
+            out_h = full_h;
+        }
     }
     
-    // Tạo texture
-    if (viewer->texture) {
-        SDL_DestroyTexture(viewer->texture);
+    if (stream) {
+        img_data = pool_malloc((size_t)full_w * full_h * 4);
+        int ok = img_data && resize_stream(viewer, stream, data_w, data_h, img_data, full_w, full_h);
+        // Lần đầu giải mã hết ảnh: giữ chỉ mục để zoom sâu về sau (xem draw_roi)
+        if (ok) store_jpeg_index(filepath, stream);
+        stbi_jpeg_stream_close(stream);
+        if (!ok) {
+            if (!prefetch) printf("Không thể resize ảnh: %s\n", filepath);
+            pool_free(img_data);
+            return 0;
+        }
+        data_w = full_w;
+        data_h = full_h;
+    }
+    
+    // JPEG, PNG không alpha: biết là ảnh đục ngay từ số kênh
+    int opaque = comp == 1 || comp == 3;
+    
+    // Thu nhỏ nhiều lần: box filter số nguyên tới tỉ lệ lũy thừa 2 lớn nhất trước,
+    // để stb_image_resize2 chỉ còn làm bước cuối trên ảnh nhỏ hơn nhiều
+    // (box filter chỉ có cho RGBA; mặt phẳng YUV đã được JPEG giải mã nửa kích thước)
+    int shift = img_data && format != SDL_PIXELFORMAT_IYUV ?
+                downscale_pow2_shift(data_w, data_h, full_w, full_h) : 0;
+    if (shift > 0) {
+        int small_w, small_h;
+        unsigned char *small = downscale_pow2(img_data, data_w, data_h, data_w * 4, shift,
+                                              !opaque, 0, &small_w, &small_h);
+        if (small) {
+            pool_free(img_data);
+            img_data = small;
+            data_w = small_w;
+            data_h = small_h;
+        }
     }
     
-    // Tạo title với tên file
+    // Ảnh có kênh alpha: quét ảnh sẽ đưa vào stbir (đã qua box filter nên nhỏ hơn
+    // nhiều). Ảnh đục được resize như 4 kênh độc lập (STBIR_4CHANNEL), bỏ hẳn bước
+    // nhân/chia alpha của stbir
+    if (img_data && !opaque && (data_w != out_w || data_h != out_h))
+        opaque = downscale_is_opaque(img_data, data_w, data_h, data_w * 4);
+    stbir_pixel_layout layout = opaque ? STBIR_4CHANNEL : STBIR_RGBA;
+    
+    if (img_data) {
+        d->source.pixels = img_data;
+        d->source.format = format;
+        d->source.w = data_w;
+        d->source.h = data_h;
+        d->source.layout = layout;
+    }
+    
+    // Resize ảnh (GIF động để GPU co giãn khi vẽ). Ở chế độ hai bước, ảnh nguồn
+    // được GPU co giãn làm ảnh xem trước, bản resize chất lượng cao tính sau
+    int preview = img_data && (data_w != out_w || data_h != out_h) &&
+                  viewer->refine_delay != REFINE_SYNC && !prefetch;
+    if (img_data && !preview && (data_w != out_w || data_h != out_h)) {
+        unsigned char *resized_data = pool_malloc(image_bytes(format, out_w, out_h));
+        ResizeCache *cache = prefetch ? &viewer->prefetch.resize_cache : &viewer->resize_cache;
+        if (!resized_data || !resize_image(viewer, cache, format, img_data, data_w, data_h,
+                                           resized_data, out_w, out_h, layout, NULL)) {
+            if (!prefetch) printf("Không thể resize ảnh: %s\n", filepath);
+            pool_free(resized_data);
+            free_source(&d->source);
+            return 0;
+        }
+        img_data = resized_data;
+        data_w = out_w;
+        data_h = out_h;
+    }
+    
+    d->pixels = img_data;
+    d->format = format;
+    d->data_w = data_w;
+    d->data_h = data_h;
+    d->img_w = img_w;
+    d->img_h = img_h;
+    d->win_w = win_w;
+    d->win_h = win_h;
+    d->out_w = out_w;
+    d->out_h = out_h;
+    d->opaque = opaque;
+    d->preview = preview;
+    d->gif = gif;
+    d->frame = frame;
+    d->delay = delay;
+    return 1;
+}
+
+// Tiêu đề theo tên file rồi đặt cửa sổ theo win_width x win_height
+int set_window_for_image(ImageViewer *viewer, const char *filepath) {
     char title[4096];
     const char *filename = strrchr(filepath, '/');
     filename = filename ? filename + 1 : filepath;
     snprintf(title, sizeof(title), "imgv - %s (%dx%d)", filename, viewer->img_width, viewer->img_height);
     
     // Resize cửa sổ (GNOME window manager handles positioning)
-    if (!resize_window(viewer, title)) {
-        free(img_data);
+    return resize_window(viewer, title);
+}
+
+// Luồng nền: giải mã trước một ảnh kề
+int prefetch_thread(void *data) {
+    ImageViewer *viewer = data;
+    Prefetch *p = &viewer->prefetch;
+    p->ok = decode_image(viewer, p->path, &p->target, &p->d, 1);
+    SDL_AtomicSet(&p->done, 1);
+    return 0;
+}
+
+// Tạo texture cho ảnh vừa giải mã trước và đưa vào cache (lỗi cũng được ghi lại)
+void store_prefetch(ImageViewer *viewer) {
+    Prefetch *p = &viewer->prefetch;
+    DecodedImage *d = &p->d;
+    TiledTexture *t = NULL;
+    if (p->ok) {
+        t = tiles_create(viewer->renderer, d->format, SDL_TEXTUREACCESS_STATIC, d->data_w, d->data_h, 0);
+        if (t) {
+            tiles_set_scale_mode(t, SDL_ScaleModeLinear);
+            tiles_set_pixels(t, d->pixels, d->pixels != d->source.pixels);
+        } else {
+            free_decoded(d);
+        }
+    }
+    cache_texture(viewer, p->path, t, &d->source, d->img_w, d->img_h, d->win_w, d->win_h, d->opaque, 0);
+}
+
+// Chờ ảnh đang giải mã trước (nếu có) xong rồi đưa vào cache
+void finish_prefetch(ImageViewer *viewer) {
+    Prefetch *p = &viewer->prefetch;
+    if (!p->thread) return;
+    SDL_WaitThread(p->thread, NULL);
+    p->thread = NULL;
+    store_prefetch(viewer);
+}
+
+// Lúc thoát: chờ luồng giải mã trước và bỏ kết quả
+void cancel_prefetch(ImageViewer *viewer) {
+    Prefetch *p = &viewer->prefetch;
+    if (p->thread) {
+        SDL_WaitThread(p->thread, NULL);
+        p->thread = NULL;
+        if (p->ok) free_decoded(&p->d);
+    }
+    free_resize_cache(viewer, &p->resize_cache);
+}
+
+// Giải mã và hiển thị ảnh
+int show_image(ImageViewer *viewer, const char *filepath) {
+    // Texture hiện tại chỉ là ảnh xem trước, hoặc chưa resize lại cho cỡ cửa sổ mới
+    int refining = viewer->refine.pending || viewer->rescale_pending;
+    viewer->redraw = 1;
+    stop_animation(viewer);
+    cancel_refinement(viewer);
+    free_pyramid(&viewer->pyramid);
+    viewer->zoom = 0;
+    
+    // Ảnh đang được giải mã trước: chờ nó xong thay vì giải mã lần nữa
+    if (viewer->prefetch.thread && strcmp(viewer->prefetch.path, filepath) == 0)
+        finish_prefetch(viewer);
+    
+    // Đã có texture trong cache (ảnh vừa xem hoặc giải mã trước): chỉ còn đổi texture
+    CachedTexture hit;
+    if (take_cached_texture(viewer, filepath, &hit)) {
+        retire_texture(viewer, refining);
+        viewer->texture = hit.texture;
+        viewer->source = hit.source;
+        viewer->target_w = hit.texture->w;
+        viewer->target_h = hit.texture->h;
+        viewer->img_width = hit.img_w;
+        viewer->img_height = hit.img_h;
+        viewer->win_width = hit.win_w;
+        viewer->win_height = hit.win_h;
+        reset_pyramid(viewer, filepath, hit.img_w, hit.img_h, hit.opaque);
+        snprintf(viewer->image_path, sizeof(viewer->image_path), "%s", filepath);
+        viewer->image_opaque = hit.opaque;
+        // Texture được làm cho cửa sổ của lúc đó; cửa sổ giữ nguyên cỡ thì có thể khác.
+        // Ảnh xem trước thì resize chất lượng cao lại từ ảnh nguồn như lần làm nét
+        if (hit.preview || window_size_locked(viewer)) {
+            viewer->rescale_pending = 1;
+            viewer->rescale_at = SDL_GetTicks();
+        }
+        return set_window_for_image(viewer, filepath);
+    }
+    
+    DecodedImage d;
+    DecodeTarget target;
+    decode_target(viewer, &target);
+    if (!decode_image(viewer, filepath, &target, &d, 0))
+        return 0;
+    
+    // Tạo texture; ảnh cũ vào cache nếu còn chỗ
+    retire_texture(viewer, refining);
+    viewer->img_width = d.img_w;
+    viewer->img_height = d.img_h;
+    viewer->win_width = d.win_w;
+    viewer->win_height = d.win_h;
+    if (!d.gif)
+        reset_pyramid(viewer, filepath, d.img_w, d.img_h, d.opaque);
+    
+    if (!set_window_for_image(viewer, filepath)) {
+        free_decoded(&d);
         return 0;
     }
     
-    // Tạo texture mới
-    viewer->texture = SDL_CreateTexture(viewer->renderer, SDL_PIXELFORMAT_RGBA32,
-                                       SDL_TEXTUREACCESS_STATIC, viewer->win_width, viewer->win_height);
+    if (d.gif) {
+        // GIF động: texture streaming kích thước gốc, mỗi frame chỉ cập nhật vùng thay đổi
+        viewer->texture = tiles_create(viewer->renderer, d.format, SDL_TEXTUREACCESS_STREAMING, d.img_w, d.img_h, 0);
+        if (!viewer->texture) {
+            printf("Không thể tạo texture: %s\n", filepath);
+            stbi_gif_stream_close(d.gif);
+            return 0;
+        }
+        tiles_set_scale_mode(viewer->texture, SDL_ScaleModeLinear);
+        tiles_update(viewer->texture, NULL, d.frame, d.img_w * 4);
+        viewer->gif = d.gif;
+        viewer->gif_frames = 1;
+        viewer->next_frame = SDL_GetTicks() + gif_frame_delay(d.delay);
+        return 1;
+    }
     
-    SDL_UpdateTexture(viewer->texture, NULL, img_data, viewer->win_width * 4);
+    // Tạo texture mới; ảnh xem trước có thể lớn hơn giới hạn texture của GPU
+    // (chưa resize), khi đó được chia ô
+    viewer->texture = tiles_create(viewer->renderer, d.format, SDL_TEXTUREACCESS_STATIC, d.data_w, d.data_h, 0);
+    if (!viewer->texture) {
+        printf("Không thể tạo texture: %s\n", filepath);
+        free_decoded(&d);
+        return 0;
+    }
+    snprintf(viewer->image_path, sizeof(viewer->image_path), "%s", filepath);
+    viewer->image_opaque = d.opaque;
+    // Cửa sổ đổi cỡ được nên GPU có thể phải co giãn mọi ảnh
+    tiles_set_scale_mode(viewer->texture, SDL_ScaleModeLinear);
+    // Ảnh nguồn sống cùng texture nên tile chưa tải lên đọc thẳng từ đó
+    tiles_set_pixels(viewer->texture, d.pixels, d.pixels != d.source.pixels);
+    viewer->source = d.source;
+    viewer->target_w = d.data_w;
+    viewer->target_h = d.data_h;
     
-    free(img_data);
+    if (d.preview && viewer->refine_delay != REFINE_OFF)
+        start_refinement(viewer, d.out_w, d.out_h, viewer->refine_delay);
     return 1;
 }
 
+// Lúc rảnh: giải mã trước ảnh kề chưa có trong cache (ảnh sau rồi ảnh trước) ở luồng
+// nền, mỗi lần một ảnh; luồng chính chỉ tạo texture khi ảnh đó xong. Các lần gọi sau
+// chỉ kiểm tra luồng nền nên vòng lặp chính không phải chờ giải mã
+void prefetch_neighbors(ImageViewer *viewer) {
+    Prefetch *p = &viewer->prefetch;
+    if (p->thread) {
+        if (SDL_AtomicGet(&p->done))
+            finish_prefetch(viewer);
+        return;
+    }
+    if (!viewer->texture_budget || !viewer->renderer || viewer->image_list.count < 2) return;
+    for (int step = 1; step >= -1; step -= 2) {
+        if (!image_list_path(viewer, viewer->image_list.current + step, p->path, sizeof(p->path)) ||
+            strcmp(p->path, viewer->image_path) == 0 || find_cached_texture(viewer, p->path))
+            continue;
+        decode_target(viewer, &p->target);
+        SDL_AtomicSet(&p->done, 0);
+        p->thread = SDL_CreateThread(prefetch_thread, "imgv-prefetch", viewer);
+        if (!p->thread) {
+            // Không tạo được luồng: giải mã ngay như lúc chưa có luồng nền
+            prefetch_thread(viewer);
+            store_prefetch(viewer);
+        }
+        return;
+    }
+}
+
+// Tải và hiển thị ảnh. IMGV_POOL_STATS=1: in thống kê pool ra stderr sau mỗi ảnh
+// (phần làm nét ở luồng nền được tính vào dòng của ảnh sau)
+int load_image(ImageViewer *viewer, const char *filepath) {
+    int ok = show_image(viewer, filepath);
+    if (viewer->pool_stats)
+        pool_print_stats(stderr, filepath);
+    return ok;
+}
+
 // Chuyển sang ảnh tiếp theo
 void next_image(ImageViewer *viewer) {
     if (viewer->image_list.count == 0) return;
@@ -234,6 +1764,50 @@ void prev_image(ImageViewer *viewer) {
     load_image(viewer, filepath);
 }
 
+// Mở ảnh (hoặc thư mục) do lần chạy sau chuyển tới ở chế độ một instance. Ảnh cùng
+// thư mục với danh sách hiện tại chỉ còn giải mã, thư mục khác thì quét lại
+void open_handoff(ImageViewer *viewer, const char *path) {
+    char filepath[4096];
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        // Như khi khởi động với thư mục: ảnh đầu tiên trong đó
+        size_t len = strlen(path);
+        int n = snprintf(filepath, sizeof(filepath), "%s%s", path, len && path[len - 1] == '/' ? "" : "/");
+        if (n < 0 || (size_t)n >= sizeof(filepath)) {
+            fprintf(stderr, "Warning: directory path too long: %s\n", path);
+            return;
+        }
+        free_image_list(&viewer->image_list);
+        viewer->image_list.current = 0;
+        load_image_list(viewer, filepath);
+        if (viewer->image_list.count == 0 || !image_list_path(viewer, 0, filepath, sizeof(filepath))) {
+            printf("Không tìm thấy ảnh trong thư mục: %s\n", path);
+            return;
+        }
+        load_image(viewer, filepath);
+        return;
+    }
+    
+    const char *slash = strrchr(path, '/');
+    size_t dir_len = slash ? (size_t)(slash - path) : 0;
+    int found = 0;
+    if (slash && strlen(viewer->current_dir) == dir_len && strncmp(viewer->current_dir, path, dir_len) == 0) {
+        for (int i = 0; i < viewer->image_list.count && !found; i++) {
+            if (strcmp(viewer->image_list.files[i], slash + 1) == 0) {
+                viewer->image_list.current = i;
+                found = 1;
+            }
+        }
+    }
+    if (!found) {
+        // Thư mục khác hoặc file mới sau lần quét trước
+        free_image_list(&viewer->image_list);
+        viewer->image_list.current = 0;
+        load_image_list(viewer, path);
+    }
+    load_image(viewer, path);
+}
+
 // Xóa file ảnh hiện tại
 void remove_current_image(ImageViewer *viewer) {
     if (viewer->image_list.count == 0) return;
@@ -298,10 +1872,34 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // IMGV_SINGLE_INSTANCE=1: đã có imgv đang chạy thì chuyển ảnh cho nó rồi thoát
+    // ngay, trước cả fork; không thì lần chạy này nhận ảnh của các lần sau (xem
+    // instance.h). Socket nghe trước fork được tiến trình con giữ
+    const char *single = getenv("IMGV_SINGLE_INSTANCE");
+    int instance_fd = -1;
+    char abs_path[4096];
+    const char *path = argv[1];
+    if (single && *single && strcmp(single, "0") != 0 && realpath(argv[1], abs_path)) {
+        // realpath bỏ '/' cuối, mà load_image_list cần nó để liệt kê chính thư mục
+        // (không phải thư mục cha)
+        struct stat st;
+        size_t len = strlen(abs_path);
+        if (stat(abs_path, &st) == 0 && S_ISDIR(st.st_mode) && abs_path[len - 1] != '/' &&
+            len + 1 < sizeof(abs_path)) {
+            abs_path[len] = '/';
+            abs_path[len + 1] = '\0';
+        }
+        path = abs_path;
+        if (instance_send(path))
+            return 0;
+        instance_fd = instance_listen();
+    }
+    
     // Detach from terminal - fork to background
     pid_t pid = fork();
     if (pid < 0) {
         perror("Fork failed");
+        instance_close(instance_fd);
         return 1;
     }
     
@@ -313,6 +1911,7 @@ int main(int argc, char *argv[]) {
     // Child process continues - detach from terminal session
     if (setsid() < 0) {
         perror("setsid failed");
+        instance_close(instance_fd);
         return 1;
     }
     
@@ -339,19 +1938,35 @@ int main(int argc, char *argv[]) {
     SDL_SetHint(SDL_HINT_VIDEO_X11_WINDOW_VISUALID, "");
     
     ImageViewer viewer = {0};
+    viewer.refine_delay = parse_refine_mode(getenv("IMGV_REFINE"));
+    viewer.resize = resize_kernels_select();
+    const char *pool_stats = getenv("IMGV_POOL_STATS");
+    viewer.pool_stats = pool_stats && *pool_stats && strcmp(pool_stats, "0") != 0;
+    // IMGV_STREAM_MB: JPEG mà bản RGBA lớn hơn số MB này được giải mã theo dải (mặc định 256)
+    const char *stream_mb = getenv("IMGV_STREAM_MB");
+    viewer.stream_bytes = (size_t)(stream_mb && *stream_mb ? strtoul(stream_mb, NULL, 10) : 256) << 20;
+    // IMGV_TEXTURE_MB: bộ nhớ cho texture và ảnh nguồn của ảnh vừa xem và ảnh kề
+    // (mặc định 128, 0 = tắt)
+    const char *texture_mb = getenv("IMGV_TEXTURE_MB");
+    viewer.texture_budget = (size_t)(texture_mb && *texture_mb ? strtoul(texture_mb, NULL, 10) : 128) << 20;
+    const char *fixed_window = getenv("IMGV_FIXED_WINDOW");
+    viewer.fixed_window = fixed_window && *fixed_window && strcmp(fixed_window, "0") != 0;
     
     // Không cần main window nữa, chỉ dùng một cửa sổ duy nhất
     viewer.window = NULL;
     viewer.renderer = NULL;
+    viewer.texture_format = SDL_PIXELFORMAT_RGBA32;
+    // Texture IYUV: JPEG lưu YCbCr BT.601 toàn dải
+    SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);
     
     // Tải danh sách ảnh trong thư mục
-    load_image_list(&viewer, argv[1]);
+    load_image_list(&viewer, path);
     
     struct stat st;
-    if (stat(argv[1], &st) == 0 && S_ISDIR(st.st_mode)) {
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
         // Nếu là thư mục, lấy ảnh đầu tiên trong viewer->image_list
         if (viewer.image_list.count == 0) {
-            printf("Không tìm thấy ảnh trong thư mục: %s\n", argv[1]);
+            printf("Không tìm thấy ảnh trong thư mục: %s\n", path);
             if (viewer.renderer) SDL_DestroyRenderer(viewer.renderer);
             if (viewer.window) SDL_DestroyWindow(viewer.window);
             SDL_Quit();
@@ -376,8 +1991,8 @@ int main(int argc, char *argv[]) {
         }
     } else {
         // Nếu là file ảnh, tải ảnh đầu tiên (sẽ tạo cửa sổ)
-        if (!load_image(&viewer, argv[1])) {
-            printf("Không thể tải ảnh: %s\n", argv[1]);
+        if (!load_image(&viewer, path)) {
+            printf("Không thể tải ảnh: %s\n", path);
             if (viewer.renderer) SDL_DestroyRenderer(viewer.renderer);
             if (viewer.window) SDL_DestroyWindow(viewer.window);
             SDL_Quit();
@@ -388,28 +2003,42 @@ int main(int argc, char *argv[]) {
     SDL_Event event;
     int running = 1;
     int dragging = 0;
+    int panning = 0;        // kéo ảnh đang zoom thay vì kéo cửa sổ
+    int drag_moved = 0;     // có SDL_MOUSEMOTION từ lần đặt vị trí cửa sổ trước
     int drag_start_x, drag_start_y;
     int window_start_x, window_start_y;
     
     while (running) {
         while (SDL_PollEvent(&event)) {
+            // Mọi sự kiện trừ di chuột không kéo ảnh đều có thể đổi thứ đang hiện
+            if (event.type != SDL_MOUSEMOTION || panning)
+                viewer.redraw = 1;
             switch (event.type) {
                 case SDL_QUIT:
                     running = 0;
                     break;
                     
                 case SDL_WINDOWEVENT:
-                    if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                        // Ngăn resize bằng cách reset lại kích thước gốc
-                        SDL_SetWindowSize(viewer.window, viewer.win_width, viewer.win_height);
-                    }
+                    if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                        window_resized(&viewer);
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+                    else if (event.window.event == SDL_WINDOWEVENT_DISPLAY_CHANGED)
+                        viewer.display_valid = 0;
+#endif
+                    break;
+                    
+                case SDL_DISPLAYEVENT:
+                    viewer.display_valid = 0;   // màn hình cắm/rút, xoay
                     break;
                     
                 case SDL_MOUSEBUTTONDOWN:
-                    if (event.button.button == SDL_BUTTON_LEFT) {
+                    if (event.button.button == SDL_BUTTON_LEFT && viewer.zoom > 0) {
+                        panning = 1;
+                    } else if (event.button.button == SDL_BUTTON_LEFT && !viewer.hit_test) {
+                        // Tọa độ màn hình: tọa độ trong cửa sổ đổi theo chính cửa sổ đang kéo
                         dragging = 1;
-                        drag_start_x = event.button.x;
-                        drag_start_y = event.button.y;
+                        drag_moved = 0;
+                        SDL_GetGlobalMouseState(&drag_start_x, &drag_start_y);
                         SDL_GetWindowPosition(viewer.window, &window_start_x, &window_start_y);
                     }
                     break;
@@ -417,24 +2046,51 @@ int main(int argc, char *argv[]) {
                 case SDL_MOUSEBUTTONUP:
                     if (event.button.button == SDL_BUTTON_LEFT) {
                         dragging = 0;
+                        panning = 0;
+                    }
+                    break;
+                    
+                case SDL_MOUSEWHEEL:
+                    if (event.wheel.y != 0) {
+                        // Zoom quanh con trỏ chuột
+                        int mx, my;
+                        SDL_GetMouseState(&mx, &my);
+                        double ax = mx, ay = my;
+                        window_to_output(&viewer, &ax, &ay);
+                        int steps = event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -event.wheel.y : event.wheel.y;
+                        zoom_at(&viewer, current_zoom(&viewer) * pow(ZOOM_STEP, steps), ax, ay);
                     }
                     break;
                     
                 case SDL_MOUSEMOTION:
-                    if (dragging) {
-                        int new_x = window_start_x + (event.motion.x - drag_start_x);
-                        int new_y = window_start_y + (event.motion.y - drag_start_y);
-                        SDL_SetWindowPosition(viewer.window, new_x, new_y);
+                    if (panning) {
+                        double dx = event.motion.xrel, dy = event.motion.yrel;
+                        window_to_output(&viewer, &dx, &dy);
+                        pan_view(&viewer, dx, dy);
+                    } else if (dragging) {
+                        drag_moved = 1;   // đặt vị trí một lần sau khi hết hàng đợi sự kiện
                     }
                     break;
                     
                 case SDL_KEYDOWN:
                     switch (event.key.keysym.sym) {
                         case SDLK_ESCAPE:
+                            // Đang toàn màn hình: Esc chỉ thoát toàn màn hình
+                            if (SDL_GetWindowFlags(viewer.window) & SDL_WINDOW_FULLSCREEN)
+                                toggle_fullscreen(&viewer);
+                            else
+                                running = 0;
+                            break;
+                            
                         case SDLK_q:
                             running = 0;
                             break;
                             
+                        case SDLK_f:
+                        case SDLK_F11:
+                            toggle_fullscreen(&viewer);
+                            break;
+                            
                         case SDLK_RIGHT:
                         case SDLK_SPACE:
                             next_image(&viewer);
@@ -448,28 +2104,100 @@ int main(int argc, char *argv[]) {
                         case SDLK_DELETE:
                             remove_current_image(&viewer);
                             break;
+                            
+                        case SDLK_PLUS:
+                        case SDLK_EQUALS:
+                        case SDLK_KP_PLUS:
+                        case SDLK_MINUS:
+                        case SDLK_KP_MINUS:
+                        case SDLK_1: {
+                            // Zoom quanh giữa cửa sổ; 1 = 100% (một pixel ảnh một pixel màn hình)
+                            int ow, oh;
+                            SDL_GetRendererOutputSize(viewer.renderer, &ow, &oh);
+                            SDL_Keycode key = event.key.keysym.sym;
+                            double zoom = key == SDLK_1 ? 1.0 :
+                                          key == SDLK_MINUS || key == SDLK_KP_MINUS ? current_zoom(&viewer) / ZOOM_STEP :
+                                          current_zoom(&viewer) * ZOOM_STEP;
+                            zoom_at(&viewer, zoom, ow / 2.0, oh / 2.0);
+                            break;
+                        }
+                            
+                        case SDLK_0:
+                        case SDLK_HOME:
+                            viewer.zoom = 0;   // vừa cửa sổ
+                            panning = 0;
+                            break;
                     }
                     break;
             }
         }
         
-        // Render
-        SDL_SetRenderDrawColor(viewer.renderer, 0, 0, 0, 255);
-        SDL_RenderClear(viewer.renderer);
+        // Mỗi frame chỉ một lần SDL_SetWindowPosition (một lượt hỏi X server/WM)
+        // dù có bao nhiêu sự kiện chuột
+        if (dragging && drag_moved) {
+            int mx, my;
+            SDL_GetGlobalMouseState(&mx, &my);
+            SDL_SetWindowPosition(viewer.window, window_start_x + mx - drag_start_x,
+                                  window_start_y + my - drag_start_y);
+            drag_moved = 0;
+        }
         
-        if (viewer.texture) {
-            SDL_RenderCopy(viewer.renderer, viewer.texture, NULL, NULL);
+        // Ảnh do lần chạy sau chuyển tới (chế độ một instance)
+        char handoff[4096];
+        if (instance_fd >= 0 && instance_receive(instance_fd, handoff, sizeof(handoff))) {
+            dragging = panning = 0;
+            open_handoff(&viewer, handoff);
+            SDL_RaiseWindow(viewer.window);
         }
         
-        SDL_RenderPresent(viewer.renderer);
+        advance_animation(&viewer);
+        if (viewer.rescale_pending && SDL_TICKS_PASSED(SDL_GetTicks(), viewer.rescale_at))
+            rescale_to_window(&viewer);
+        update_refinement(&viewer);
+        
+        // Còn ô zoom sâu chưa giải mã: frame sau vẽ thêm
+        if (viewer.zoom > 0 && viewer.pyramid.roi_missing)
+            viewer.redraw = 1;
+        present_frame(&viewer);
         
-        SDL_Delay(40); // ~25 FPS
+        // ~25 FPS, hoặc sớm hơn nếu frame GIF tiếp theo đến trước
+        Uint32 wait = 40;
+        if (viewer.gif) {
+            Sint32 left = (Sint32)(viewer.next_frame - SDL_GetTicks());
+            wait = left < 0 ? 0 : left < 40 ? (Uint32)left : 40;
+        }
+        // Đang làm nét: kiểm tra thường hơn để thay ảnh ngay khi xong
+        if (viewer.refine.pending && wait > 10)
+            wait = 10;
+        // Đang kéo ảnh hoặc tự kéo cửa sổ: theo nhịp màn hình
+        if ((panning || dragging) && wait > 16)
+            wait = 16;
+        // Đang đổi cỡ cửa sổ: vẽ theo nhịp màn hình, resize lại đúng lúc thôi kéo
+        if (viewer.rescale_pending && wait > 16)
+            wait = 16;
+        // Còn ô zoom sâu chưa giải mã: vẽ tiếp ngay
+        if (viewer.zoom > 0 && viewer.pyramid.roi_missing && wait > 16)
+            wait = 16;
+        // Rảnh: giải mã trước ảnh kề để lần chuyển ảnh tới chỉ còn vẽ lại
+        if (!viewer.refine.pending && !viewer.rescale_pending && !viewer.gif && viewer.zoom <= 0 && !dragging) {
+            Uint32 start = SDL_GetTicks();
+            prefetch_neighbors(&viewer);
+            Uint32 spent = SDL_GetTicks() - start;
+            wait = spent < wait ? wait - spent : 0;
+        }
+        SDL_Delay(wait);
     }
     
     // Dọn dẹp
-    if (viewer.texture) {
-        SDL_DestroyTexture(viewer.texture);
-    }
+    instance_close(instance_fd);
+    stop_animation(&viewer);
+    cancel_refinement(&viewer);
+    cancel_prefetch(&viewer);
+    free_resize_cache(&viewer, &viewer.resize_cache);
+    tiles_destroy(viewer.texture);
+    free_source(&viewer.source);
+    free_texture_cache(&viewer);
+    free_pyramid(&viewer.pyramid);
     free_image_list(&viewer.image_list);
     
     // Dọn dẹp cửa sổ
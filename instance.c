@@ -0,0 +1,136 @@
+// Chế độ một instance qua Unix domain socket (xem instance.h)
+
+#define _GNU_SOURCE
+
+#include "instance.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define INSTANCE_PATH_MAX 4096
+
+// Địa chỉ socket của người dùng; 0 nếu đường dẫn quá dài cho sun_path
+static int instance_address(struct sockaddr_un *addr) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = runtime && *runtime ?
+            snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/imgv.sock", runtime) :
+            snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/imgv-%u.sock", (unsigned)getuid());
+    return n > 0 && (size_t)n < sizeof(addr->sun_path);
+}
+
+// File socket tồn tại và thuộc người dùng này
+static int instance_owned(const struct sockaddr_un *addr) {
+    struct stat st;
+    return lstat(addr->sun_path, &st) == 0 && S_ISSOCK(st.st_mode) && st.st_uid == getuid();
+}
+
+// Kết nối tới instance đang nghe; -1 nếu không có
+static int instance_connect(const struct sockaddr_un *addr) {
+    if (!instance_owned(addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int instance_send(const char *path) {
+    struct sockaddr_un addr;
+    size_t len = strlen(path);
+    if (len == 0 || len >= INSTANCE_PATH_MAX || !instance_address(&addr)) return 0;
+    int fd = instance_connect(&addr);
+    if (fd < 0) return 0;
+
+    // Bên nhận đọc tới khi kết nối đóng
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, path + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += n;
+    }
+    close(fd);
+    return sent == len;
+}
+
+int instance_listen(void) {
+    struct sockaddr_un addr;
+    if (!instance_address(&addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+
+    mode_t old_mask = umask(077);   // chỉ người dùng này kết nối được
+    int ok = bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (!ok && errno == EADDRINUSE) {
+        // Socket của instance đã chết thì thay; còn instance nghe thì để nó nhận
+        int other = instance_connect(&addr);
+        if (other >= 0)
+            close(other);
+        else if (instance_owned(&addr) && unlink(addr.sun_path) == 0)
+            ok = bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    umask(old_mask);
+    if (!ok || listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int instance_receive(int fd, char *path, size_t size) {
+    int got = 0;
+    for (;;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            return got;   // EAGAIN: hết kết nối chờ
+        }
+
+        // Bên gửi ghi xong là đóng ngay; không chờ kết nối treo quá 1 giây
+        struct timeval timeout = { 1, 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char buf[INSTANCE_PATH_MAX];
+        size_t len = 0;
+        ssize_t n;
+        for (;;) {
+            if (len == sizeof(buf)) {
+                n = -1;   // quá dài
+                break;
+            }
+            n = recv(conn, buf + len, sizeof(buf) - len, 0);
+            if (n > 0)
+                len += n;
+            else if (n < 0 && errno == EINTR)
+                continue;
+            else
+                break;
+        }
+        close(conn);
+
+        // Chỉ nhận đường dẫn trọn vẹn (bên gửi đã đóng kết nối)
+        if (n == 0 && len > 0 && len < size && !memchr(buf, '\0', len)) {
+            memcpy(path, buf, len);
+            path[len] = '\0';
+            got = 1;
+        }
+    }
+}
+
+void instance_close(int fd) {
+    struct sockaddr_un addr;
+    if (fd < 0) return;
+    close(fd);
+    if (instance_address(&addr))
+        unlink(addr.sun_path);
+}
@@ -0,0 +1,32 @@
+// instance.h - Chế độ một instance: lần chạy sau chuyển ảnh cho imgv đang chạy
+//
+// Mỗi lần mở ảnh từ file manager là một lần khởi động lạnh (fork, SDL_Init, tạo
+// cửa sổ, quét thư mục). Ở chế độ một instance, imgv đang chạy nghe trên Unix
+// domain socket riêng của người dùng; lần chạy sau chỉ kết nối, gửi đường dẫn
+// tuyệt đối của ảnh rồi thoát, còn imgv đang chạy mở ảnh đó với danh sách thư
+// mục, cache texture và SDL đã sẵn.
+//
+// Socket: $XDG_RUNTIME_DIR/imgv.sock, không có thì /tmp/imgv-<uid>.sock. Socket
+// của người dùng khác không bao giờ được dùng; socket cũ của instance đã chết
+// (kết nối bị từ chối) được thay.
+
+#ifndef IMGV_INSTANCE_H
+#define IMGV_INSTANCE_H
+
+#include <stddef.h>
+
+// Gửi path (đường dẫn tuyệt đối) cho instance đang chạy; 1 nếu đã gửi
+int instance_send(const char *path);
+
+// Nghe kết nối của các lần chạy sau; trả về socket (non-blocking) hoặc -1 nếu
+// không nghe được (đã có instance khác, đường dẫn socket quá dài...)
+int instance_listen(void);
+
+// Nhận các đường dẫn đang chờ, không chặn; giữ đường dẫn mới nhất trong path.
+// 1 nếu có ít nhất một đường dẫn
+int instance_receive(int fd, char *path, size_t size);
+
+// Đóng socket và xóa file socket
+void instance_close(int fd);
+
+#endif // IMGV_INSTANCE_H
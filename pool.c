@@ -0,0 +1,215 @@
+// Bộ cấp phát dùng lại bộ nhớ giữa các ảnh (xem pool.h)
+
+#define _GNU_SOURCE
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define POOL_HEADER 64                      // giữ khối trả về căn 64 byte
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+#define POOL_DEFAULT_MB 512
+
+// Nằm ngay trước vùng nhớ trả về
+typedef struct PoolBlock {
+    size_t size;       // kích thước được yêu cầu
+    size_t mapped;     // byte đã mmap kể cả header; 0 = khối nhỏ từ malloc
+    struct PoolBlock *prev, *next;   // trong danh sách khối rảnh, mới rảnh nhất trước
+} PoolBlock;
+
+typedef char pool_header_fits[sizeof(PoolBlock) <= POOL_HEADER ? 1 : -1];
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static PoolBlock *pool_head, *pool_tail;
+static PoolStats pool_stats;
+static size_t pool_limit = (size_t)-1;   // đọc IMGV_POOL_MB lần đầu cần
+
+// Lớp của khối total byte (kể cả header): làm tròn lên bội của 1/4 lũy thừa 2
+// lớn nhất không vượt total, nên phí tối đa 25% (chỉ là địa chỉ ảo cho tới khi
+// được ghi); từ 2 MB làm tròn lên bội của huge page. 0 = khối nhỏ
+static size_t pool_class_size(size_t total) {
+    if (total < POOL_MIN_BLOCK) return 0;
+    size_t step = POOL_MIN_BLOCK / 4;
+    while (step * 8 <= total) step *= 2;
+    size_t bytes = (total + step - 1) / step * step;
+    if (bytes >= POOL_HUGE_PAGE)
+        bytes = (bytes + POOL_HUGE_PAGE - 1) / POOL_HUGE_PAGE * POOL_HUGE_PAGE;
+    return bytes;
+}
+
+static PoolBlock *pool_map(size_t bytes) {
+    char *start;
+    if (bytes >= POOL_HUGE_PAGE) {
+        // Lấy dư 2 MB rồi cắt hai đầu để khối bắt đầu đúng ranh giới huge page
+        char *raw = mmap(NULL, bytes + POOL_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return NULL;
+        start = (char *)(((uintptr_t)raw + POOL_HUGE_PAGE - 1) & ~(uintptr_t)(POOL_HUGE_PAGE - 1));
+        if (start > raw) munmap(raw, start - raw);
+        if (raw + POOL_HUGE_PAGE > start) munmap(start + bytes, raw + POOL_HUGE_PAGE - start);
+#ifdef MADV_HUGEPAGE
+        madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+    } else {
+        start = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (start == MAP_FAILED) return NULL;
+    }
+    PoolBlock *b = (PoolBlock *)start;
+    b->mapped = bytes;
+    return b;
+}
+
+static void pool_unlink(PoolBlock *b) {
+    if (b->prev) b->prev->next = b->next; else pool_head = b->next;
+    if (b->next) b->next->prev = b->prev; else pool_tail = b->prev;
+    pool_stats.cached -= b->mapped;
+}
+
+// Gọi khi đang giữ pool_lock
+static void pool_update_peak(void) {
+    if (pool_stats.in_use + pool_stats.cached > pool_stats.peak)
+        pool_stats.peak = pool_stats.in_use + pool_stats.cached;
+}
+
+void *pool_malloc(size_t size) {
+    if (size > SIZE_MAX / 2) return NULL;
+    size_t bytes = pool_class_size(size + POOL_HEADER);
+    PoolBlock *b;
+
+    if (!bytes) {
+        b = malloc(size + POOL_HEADER);
+        if (!b) return NULL;
+        b->mapped = 0;
+    } else {
+        pthread_mutex_lock(&pool_lock);
+        pool_stats.allocs++;
+        for (b = pool_head; b && b->mapped != bytes; b = b->next) {}
+        if (b) {
+            pool_unlink(b);
+            pool_stats.reused++;
+            pool_stats.in_use += bytes;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        if (!b) {
+            b = pool_map(bytes);
+            if (!b) return NULL;
+            pthread_mutex_lock(&pool_lock);
+            pool_stats.mapped++;
+            pool_stats.in_use += bytes;
+            pool_update_peak();
+            pthread_mutex_unlock(&pool_lock);
+        }
+    }
+    b->size = size;
+    return (char *)b + POOL_HEADER;
+}
+
+void *pool_realloc(void *ptr, size_t size) {
+    if (!ptr) return pool_malloc(size);
+    PoolBlock *b = (PoolBlock *)((char *)ptr - POOL_HEADER);
+
+    if (!b->mapped && !pool_class_size(size + POOL_HEADER)) {
+        b = realloc(b, size + POOL_HEADER);
+        if (!b) return NULL;
+        b->size = size;
+        return (char *)b + POOL_HEADER;
+    }
+    // Lớp kích thước có chỗ trống nên zlib tăng bộ đệm dần thường không phải chuyển chỗ
+    if (b->mapped && size + POOL_HEADER <= b->mapped) {
+        pthread_mutex_lock(&pool_lock);
+        pool_stats.in_place++;
+        pthread_mutex_unlock(&pool_lock);
+        b->size = size;
+        return ptr;
+    }
+    void *p = pool_malloc(size);
+    if (!p) return NULL;
+    memcpy(p, ptr, b->size < size ? b->size : size);
+    pool_free(ptr);
+    return p;
+}
+
+void pool_free(void *ptr) {
+    if (!ptr) return;
+    PoolBlock *b = (PoolBlock *)((char *)ptr - POOL_HEADER);
+    if (!b->mapped) {
+        free(b);
+        return;
+    }
+
+    PoolBlock *evicted = NULL;
+    pthread_mutex_lock(&pool_lock);
+    if (pool_limit == (size_t)-1) {
+        const char *env = getenv("IMGV_POOL_MB");
+        pool_limit = (size_t)(env && *env ? strtoul(env, NULL, 10) : POOL_DEFAULT_MB) << 20;
+    }
+    pool_stats.in_use -= b->mapped;
+    b->prev = NULL;
+    b->next = pool_head;
+    if (pool_head) pool_head->prev = b; else pool_tail = b;
+    pool_head = b;
+    pool_stats.cached += b->mapped;
+    pool_update_peak();
+    // Vượt giới hạn: bỏ các khối rảnh lâu nhất, munmap sau khi nhả khóa
+    while (pool_stats.cached > pool_limit) {
+        PoolBlock *victim = pool_tail;
+        pool_unlink(victim);
+        pool_stats.unmapped++;
+        victim->next = evicted;
+        evicted = victim;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    while (evicted) {
+        PoolBlock *next = evicted->next;
+        munmap(evicted, evicted->mapped);
+        evicted = next;
+    }
+}
+
+void pool_trim(void) {
+    pthread_mutex_lock(&pool_lock);
+    PoolBlock *b = pool_head;
+    for (PoolBlock *c = b; c; c = c->next) pool_stats.unmapped++;
+    pool_head = pool_tail = NULL;
+    pool_stats.cached = 0;
+    pthread_mutex_unlock(&pool_lock);
+
+    while (b) {
+        PoolBlock *next = b->next;
+        munmap(b, b->mapped);
+        b = next;
+    }
+}
+
+void pool_get_stats(PoolStats *stats) {
+    pthread_mutex_lock(&pool_lock);
+    *stats = pool_stats;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void pool_reset_peak(void) {
+    pthread_mutex_lock(&pool_lock);
+    pool_stats.peak = pool_stats.in_use + pool_stats.cached;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void pool_print_stats(FILE *out, const char *label) {
+    static long last_faults = 0;
+    PoolStats s;
+    struct rusage ru;
+
+    pool_get_stats(&s);
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(out, "pool %s: %lu khối lớn (%lu dùng lại, %lu mmap mới, %lu trả lại, %lu realloc tại chỗ), "
+                 "đang dùng %.1f MB, giữ %.1f MB, đỉnh %.1f MB, %ld page fault\n",
+            label, s.allocs, s.reused, s.mapped, s.unmapped, s.in_place,
+            s.in_use / 1048576.0, s.cached / 1048576.0, s.peak / 1048576.0, ru.ru_minflt - last_faults);
+    last_faults = ru.ru_minflt;
+}
@@ -0,0 +1,46 @@
+// pool.h - Bộ cấp phát cho bộ đệm pixel và bộ giải mã, dùng lại bộ nhớ giữa các ảnh
+//
+// Khối lớn (>= POOL_MIN_BLOCK) được mmap theo lớp kích thước (4 lớp mỗi lần gấp
+// đôi) và khi giải phóng được giữ lại trong pool thay vì trả cho hệ điều hành.
+// Chuyển giữa các ảnh cùng cỡ lấy lại đúng khối đã chạm trang nên không tốn mmap
+// hay page fault mới. Khối từ 2 MB được căn 2 MB và đánh dấu MADV_HUGEPAGE.
+// Khối nhỏ đi thẳng tới malloc. stb_image (STBI_MALLOC...), stb_image_resize2
+// (STBIR_MALLOC) và downscale.h đều cấp phát qua đây; bộ nhớ cấp ở đây phải được
+// giải phóng bằng pool_free (hoặc stbi_image_free), không dùng free.
+//
+// Biến môi trường IMGV_POOL_MB: số MB tối đa giữ lại khi rảnh (mặc định 512,
+// 0 = không giữ).
+
+#ifndef IMGV_POOL_H
+#define IMGV_POOL_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define POOL_MIN_BLOCK (128 * 1024)
+
+typedef struct {
+    unsigned long allocs;     // số lần cấp khối lớn
+    unsigned long reused;     // ... lấy lại từ pool
+    unsigned long mapped;     // ... phải mmap mới
+    unsigned long unmapped;   // số khối trả lại hệ điều hành (pool đầy)
+    unsigned long in_place;   // pool_realloc không phải chuyển chỗ
+    size_t in_use;            // byte của các khối lớn đang dùng (theo lớp)
+    size_t cached;            // byte đang giữ trong pool
+    size_t peak;              // in_use + cached lớn nhất
+} PoolStats;
+
+void *pool_malloc(size_t size);
+void *pool_realloc(void *ptr, size_t size);
+void pool_free(void *ptr);
+
+// Trả hết các khối đang giữ về hệ điều hành
+void pool_trim(void);
+
+void pool_get_stats(PoolStats *stats);
+// Đặt lại peak về mức hiện tại để đo đỉnh của một đoạn riêng
+void pool_reset_peak(void);
+// In thống kê kèm số page fault (minor) của tiến trình từ lần in trước
+void pool_print_stats(FILE *out, const char *label);
+
+#endif // IMGV_POOL_H
@@ -0,0 +1,53 @@
+// Chọn bản stb_image_resize2 theo cpuid (xem resize_simd.h)
+
+#include "resize_simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Makefile định nghĩa RESIZE_HAVE_AVX2 / RESIZE_HAVE_AVX512 cho các bản đã biên dịch
+extern const ResizeKernels resize_kernels_base;
+#ifdef RESIZE_HAVE_AVX2
+extern const ResizeKernels resize_kernels_avx2;
+#endif
+#ifdef RESIZE_HAVE_AVX512
+extern const ResizeKernels resize_kernels_avx512;
+#endif
+
+int resize_kernels_supported(const ResizeKernels **out, int max) {
+    int n = 0;
+    if (n < max) out[n++] = &resize_kernels_base;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+#ifdef RESIZE_HAVE_AVX2
+    // mọi CPU có AVX2 + FMA đều có F16C
+    if (n < max && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        out[n++] = &resize_kernels_avx2;
+#endif
+#ifdef RESIZE_HAVE_AVX512
+    if (n < max && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+        __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq"))
+        out[n++] = &resize_kernels_avx512;
+#endif
+#endif
+    return n;
+}
+
+const ResizeKernels *resize_kernels_select(void) {
+    static const ResizeKernels *selected = NULL;
+    if (selected) return selected;
+
+    const ResizeKernels *list[RESIZE_MAX_VARIANTS];
+    int n = resize_kernels_supported(list, RESIZE_MAX_VARIANTS);
+    selected = list[n - 1];
+
+    const char *force = getenv("IMGV_RESIZE_SIMD");
+    if (force && *force) {
+        for (int i = 0; i < n; i++) {
+            if (strcmp(list[i]->name, force) == 0)
+                selected = list[i];
+        }
+    }
+    return selected;
+}
@@ -0,0 +1,59 @@
+// Một bản stb_image_resize2: được biên dịch một lần cho mỗi tập lệnh với
+// -DRESIZE_VARIANT=<tên> và cờ -m tương ứng (xem Makefile). Hàm của stbir là
+// static nên các bản không đụng tên nhau; bên ngoài chỉ thấy bảng ResizeKernels.
+
+#ifndef RESIZE_VARIANT
+#define RESIZE_VARIANT base
+#endif
+
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"   // các API stbir không đưa vào bảng
+#pragma GCC diagnostic ignored "-Wsign-compare"      // macro profiler của stbir
+#pragma GCC diagnostic ignored "-Wunused-local-typedefs"
+#ifndef asm
+#define asm __asm__   // profiler của stbir dùng từ khóa asm, không có trong -std=c99
+#endif
+#endif
+
+#include "pool.h"
+#define STBIR_MALLOC(size, user_data) ((void)(user_data), pool_malloc(size))
+#define STBIR_FREE(ptr, user_data)    ((void)(user_data), pool_free(ptr))
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STB_IMAGE_RESIZE_STATIC
+#include "resize_simd.h"
+
+#define RESIZE_TABLE_NAME2(v) resize_kernels_##v
+#define RESIZE_TABLE_NAME(v) RESIZE_TABLE_NAME2(v)
+
+// Tên lấy từ chính các macro stbir đã bật trong bản này
+#if defined(STBIR_AVX2) && defined(__AVX512F__)
+#define RESIZE_ISA_NAME "avx512"
+#elif defined(STBIR_AVX2)
+#define RESIZE_ISA_NAME "avx2"
+#elif defined(STBIR_AVX)
+#define RESIZE_ISA_NAME "avx"
+#elif defined(STBIR_SSE2)
+#define RESIZE_ISA_NAME "sse2"
+#elif defined(STBIR_NEON)
+#define RESIZE_ISA_NAME "neon"
+#elif defined(STBIR_WASM)
+#define RESIZE_ISA_NAME "wasm"
+#else
+#define RESIZE_ISA_NAME "scalar"
+#endif
+
+const ResizeKernels RESIZE_TABLE_NAME(RESIZE_VARIANT) = {
+    RESIZE_ISA_NAME,
+    stbir_resize_init,
+    stbir_set_buffer_ptrs,
+    stbir_build_samplers_with_splits,
+    stbir_resize_extended_split,
+    stbir_free_samplers,
+    stbir_resize_uint8_srgb,
+#ifdef STBIR_PROFILE
+    stbir_resize_split_profile_info,
+#endif
+    stbir_set_pixel_callbacks,
+    stbir_set_user_data,
+};
@@ -0,0 +1,51 @@
+// resize_simd.h - stb_image_resize2 cho nhiều tập lệnh SIMD, chọn lúc chạy
+//
+// stb_image_resize2 chỉ bật AVX2 khi trình biên dịch thấy __AVX2__, nên build
+// -O2 thường luôn chạy kernel SSE2. resize_kernels.c được biên dịch nhiều lần
+// (mỗi lần một file .o với cờ -m riêng, xem Makefile), mỗi bản xuất một bảng
+// ResizeKernels; resize_kernels_select() chọn bản tốt nhất CPU hỗ trợ.
+// STBIR_RESIZE dựng bằng bảng nào thì chỉ được dùng tiếp với bảng đó.
+
+#ifndef IMGV_RESIZE_SIMD_H
+#define IMGV_RESIZE_SIMD_H
+
+// Profiler của stbir chỉ bật cho imgv-bench (Makefile thêm -DRESIZE_PROFILE cho
+// bench.c và các bản resize_bench_*.o) để in thời gian từng giai đoạn của từng
+// bản. stbir đọc bộ đếm bằng asm riêng cho x86 và aarch64, CPU khác thì bỏ qua.
+// Mọi file của một binary phải cùng cờ này: bảng ResizeKernels đổi theo nó
+#if defined(RESIZE_PROFILE) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__))
+#define STBIR_PROFILE
+#endif
+#include "stb_image_resize2.h"
+
+#define RESIZE_MAX_VARIANTS 3
+
+typedef struct {
+    const char *name;   // tập lệnh stbir thực sự dùng trong bản này: "sse2", "avx2", "avx512"...
+    void (*resize_init)(STBIR_RESIZE *resize,
+                        const void *input_pixels, int input_w, int input_h, int input_stride_in_bytes,
+                        void *output_pixels, int output_w, int output_h, int output_stride_in_bytes,
+                        stbir_pixel_layout pixel_layout, stbir_datatype data_type);
+    void (*set_buffer_ptrs)(STBIR_RESIZE *resize, const void *input_pixels, int input_stride_in_bytes,
+                            void *output_pixels, int output_stride_in_bytes);
+    int (*build_samplers_with_splits)(STBIR_RESIZE *resize, int try_splits);
+    int (*resize_extended_split)(STBIR_RESIZE *resize, int split_start, int split_count);
+    void (*free_samplers)(STBIR_RESIZE *resize);
+    unsigned char *(*resize_uint8_srgb)(const unsigned char *input_pixels, int input_w, int input_h, int input_stride_in_bytes,
+                                        unsigned char *output_pixels, int output_w, int output_h, int output_stride_in_bytes,
+                                        stbir_pixel_layout pixel_layout);
+#ifdef STBIR_PROFILE
+    void (*split_profile_info)(STBIR_PROFILE_INFO *info, STBIR_RESIZE const *resize, int split_start, int split_num);
+#endif
+    // Lấy dòng đầu vào qua callback thay vì từ bộ đệm (giải mã theo dải)
+    void (*set_pixel_callbacks)(STBIR_RESIZE *resize, stbir_input_callback *input_cb, stbir_output_callback *output_cb);
+    void (*set_user_data)(STBIR_RESIZE *resize, void *user_data);
+} ResizeKernels;
+
+// Bản tốt nhất CPU hỗ trợ; biến môi trường IMGV_RESIZE_SIMD=<tên> ép dùng một bản
+const ResizeKernels *resize_kernels_select(void);
+
+// Các bản có trong binary mà CPU chạy được, bản cơ sở trước; trả về số bản
+int resize_kernels_supported(const ResizeKernels **out, int max);
+
+#endif // IMGV_RESIZE_SIMD_H
@@ -276,6 +276,19 @@ RECENT REVISION HISTORY:
 //
 // ===========================================================================
 //
+// Multithreading
+//
+// Define STBI_THREADS where the implementation is compiled to spread JPEG
+// reconstruction (dequantize + IDCT for progressive files, upsampling and
+// color conversion for all files) over a small pool of worker threads. This
+// needs pthreads and GCC-style __atomic builtins. The workers are started on
+// first use and live until the process exits; stbi_set_thread_count() sets
+// how many threads (including the caller) a single decode may use. Loads
+// running concurrently on several threads are safe: only one of them uses
+// the pool at a time, the others decode on their own thread.
+//
+// ===========================================================================
+//
 // HDR image support   (disable by defining STBI_NO_HDR)
 //
 // stb_image supports loading HDR images in general, and currently the Radiance
@@ -431,6 +444,75 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// animated GIFs one frame at a time. unlike stbi_load_gif_from_memory, which
+// keeps every frame, a stream composites each frame onto one x*y RGBA canvas
+// (plus the two frames before it, for "restore to previous" disposal), so
+// memory doesn't grow with the number of frames.
+//
+// stbi_gif_stream_next returns the canvas, valid until the next call, or NULL
+// at the end of the animation or on a decoding error. *delay_ms gets the
+// frame's delay and rect (x, y, w, h) the area that changed since the
+// previous frame. stbi_gif_stream_more tells whether another frame follows;
+// stbi_gif_stream_rewind goes back to the first frame.
+typedef struct stbi_gif_stream stbi_gif_stream;
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(char const *filename, int *x, int *y);
+#endif
+STBIDEF stbi_uc const   *stbi_gif_stream_next(stbi_gif_stream *gs, int *delay_ms, int rect[4]);
+STBIDEF int              stbi_gif_stream_more(stbi_gif_stream *gs);
+STBIDEF int              stbi_gif_stream_rewind(stbi_gif_stream *gs);
+STBIDEF void             stbi_gif_stream_close(stbi_gif_stream *gs);
+#endif
+
+#ifndef STBI_NO_JPEG
+// JPEGs as planar YCbCr, for YUV textures such as SDL's IYUV: a Y plane of
+// *x by *y bytes followed by the Cb and the Cr plane, each (*x+1)/2 by
+// (*y+1)/2 bytes, full range BT.601 as JPEG stores them. chroma stored at a
+// higher resolution than that is box filtered down; grayscale gets neutral
+// chroma. stbi_set_jpeg_fit_size applies as it does to stbi_load. returns
+// NULL without decoding the image for anything else (not a JPEG, RGB, CMYK,
+// luma below full resolution), so the caller can fall back to stbi_load.
+STBIDEF stbi_uc *stbi_load_jpeg_yuv_from_memory(stbi_uc const *buffer, int len, int *x, int *y);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_jpeg_yuv(char const *filename, int *x, int *y);
+#endif
+
+// baseline JPEGs one 4-channel RGBA row at a time (BGRA with
+// stbi_set_bgr_on_load), for images too big to decode whole: only three MCU
+// rows of the image are held in memory, so a resizer reading rows through a
+// callback (stb_image_resize2's input callback) never needs the full image.
+// rows must be asked for in increasing order, though the same row may be
+// asked for again; the pointer is valid until the next call. returns NULL
+// for progressive JPEGs and baseline ones with a scan per component, which
+// need the whole image. as with stbi_load, rows past corrupt data come out
+// as whatever the decoder had left in its buffers.
+typedef struct stbi_jpeg_stream stbi_jpeg_stream;
+
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open(char const *filename, int *x, int *y);
+#endif
+STBIDEF stbi_uc const    *stbi_jpeg_stream_row(stbi_jpeg_stream *js, int y);
+STBIDEF void              stbi_jpeg_stream_close(stbi_jpeg_stream *js);
+
+// random access into the same JPEGs. while a stbi_jpeg_stream decodes, it
+// records the entropy decoder's state (file offset, bit buffer, DC
+// predictors) every STBI_JPEG_INDEX_STEP MCUs of each MCU row. once the last
+// row has been asked for, stbi_jpeg_stream_index returns that state as a
+// blob of *len bytes (free with stbi_image_free) to keep, e.g. on disk; NULL
+// if the scan ended early. stbi_jpeg_load_region then decodes a w x h
+// rectangle of the file at x,y from it: only the MCU rows covering the
+// rectangle are entropy decoded, from the nearest recorded MCU on, and only
+// the MCUs around it are idct'd. the pixels are those stbi_load gives, 4
+// channels. returns NULL if the index doesn't match the file.
+#define STBI_JPEG_INDEX_STEP 32
+STBIDEF void             *stbi_jpeg_stream_index(stbi_jpeg_stream *js, int *len);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc          *stbi_jpeg_load_region(char const *filename, void const *index, int index_len, int x, int y, int w, int h);
+#endif
 #endif
 
 #ifdef STBI_WINDOWS_UTF8
@@ -524,6 +606,61 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// use the straightforward reference versions of decoder loops that have a
+// faster specialized implementation (JPEG progressive refinement scans).
+// output is identical either way; this only exists for benchmarking and
+// validating the fast paths. applies to images subsequently decoded on the
+// calling thread
+STBIDEF void stbi_set_reference_kernels(int flag_true_if_should_use_reference);
+
+// JPEGs subsequently decoded on the calling thread that would have to shrink
+// at least 2x to fit in max_w x max_h come out at half size, ceil(x/2) by
+// ceil(y/2): luma is box filtered down to 4:2:0 chroma resolution instead of
+// chroma being upsampled to full size. 0,0 (the default) turns this off.
+// stbi_info still reports the full size.
+STBIDEF void stbi_set_jpeg_fit_size(int max_w, int max_h);
+
+// 8-bit images with 3 or 4 output channels subsequently decoded on the
+// calling thread come out as B,G,R(,A) instead of R,G,B(,A), the byte order
+// many renderers take without converting. JPEG and GIF (including the GIF
+// stream) write that order as they go; other formats are swapped in one pass
+// after decoding. 16-bit, float and stbi_load_gif_from_memory are unaffected.
+STBIDEF void stbi_set_bgr_on_load(int flag_true_if_should_output_bgr);
+
+#ifdef STBI_THREADS
+// number of threads a decode may use, counting the calling thread. 0 (the
+// default) uses one per online CPU, 1 disables the worker pool
+STBIDEF void stbi_set_thread_count(int count);
+#endif
+
+#ifdef STBI_JPEG_STATS
+// optional timing breakdown of the JPEG decoder, one entry per scan. define
+// STBI_JPEG_STATS where the implementation is compiled; STBI_TIMER() can be
+// defined to a function returning seconds as a double (default is clock()).
+#define STBI_JPEG_STATS_MAX_SCANS 64
+
+typedef struct
+{
+   int components;          // bitmask of the frame components coded in this scan
+   int spec_start, spec_end;
+   int succ_high, succ_low;
+   double seconds;          // entropy decoding of the scan
+} stbi_jpeg_scan_stats;
+
+typedef struct
+{
+   int progressive;
+   int scan_count;          // scans past STBI_JPEG_STATS_MAX_SCANS are counted but not recorded
+   stbi_jpeg_scan_stats scan[STBI_JPEG_STATS_MAX_SCANS];
+   int threads;                // threads used for reconstruction
+   int pipelined;              // baseline: reconstruction ran during the scan and is included in its time
+   double reconstruct_seconds; // dequantize + IDCT (progressive only), upsampling and color conversion
+} stbi_jpeg_stats;
+
+// JPEGs subsequently decoded on the calling thread fill in *stats (NULL to stop)
+STBIDEF void stbi_set_jpeg_stats(stbi_jpeg_stats *stats);
+#endif
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -598,6 +735,16 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #include <stdio.h>
 #endif
 
+#ifdef STBI_THREADS
+#include <pthread.h>
+#include <unistd.h> // sysconf
+#endif
+
+#if defined(STBI_JPEG_STATS) && !defined(STBI_TIMER)
+#include <time.h>
+#define STBI_TIMER()  ((double) clock() / CLOCKS_PER_SEC)
+#endif
+
 #ifndef STBI_ASSERT
 #include <assert.h>
 #define STBI_ASSERT(x) assert(x)
@@ -643,12 +790,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -1134,6 +1283,236 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL int stbi__reference_kernels;
+#else
+static int stbi__reference_kernels;
+#endif
+
+STBIDEF void stbi_set_reference_kernels(int flag_true_if_should_use_reference)
+{
+   stbi__reference_kernels = flag_true_if_should_use_reference;
+}
+
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+int stbi__bgr_on_load;
+
+STBIDEF void stbi_set_bgr_on_load(int flag_true_if_should_output_bgr)
+{
+   stbi__bgr_on_load = flag_true_if_should_output_bgr;
+}
+
+// swap the first and third channel of count n-channel pixels (n is 3 or 4)
+static void stbi__swap_rb(stbi_uc *p, size_t count, int n)
+{
+   size_t i = 0;
+#ifdef STBI_SSE2
+   if (n == 4 && stbi__sse2_available()) {
+      __m128i ga = _mm_set1_epi32((int) 0xff00ff00), lo = _mm_set1_epi32(0xff);
+      for (; i + 4 <= count; i += 4) {
+         __m128i v = _mm_loadu_si128((__m128i *) (p + i*4));
+         __m128i r = _mm_and_si128(v, lo), b = _mm_and_si128(_mm_srli_epi32(v, 16), lo);
+         v = _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(_mm_slli_epi32(r, 16), b));
+         _mm_storeu_si128((__m128i *) (p + i*4), v);
+      }
+   }
+#endif
+   for (; i < count; ++i) {
+      stbi_uc t = p[i*n];
+      p[i*n] = p[i*n + 2];
+      p[i*n + 2] = t;
+   }
+}
+
+// parallel loops: stbi__parallel_for(func, ctx, count, threads) calls
+// func(ctx, i, thread) for every i in [0,count), in no particular order, and
+// returns when all calls are done. 'threads' is a stbi__thread_count() result
+// that per-thread scratch was sized for; 'thread' is below it and unique among
+// the calls running at the same time. the calling thread is thread 0, the
+// pool's workers are never thread 0.
+typedef void (*stbi__job_func)(void *ctx, int index, int thread);
+
+#ifdef STBI_THREADS
+#define STBI__MAX_THREADS  64
+
+#define stbi__atomic_load(p)        __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define stbi__atomic_store(p,v)     __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define stbi__atomic_exchange(p,v)  __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define stbi__atomic_cas(p,old,v)   __atomic_compare_exchange_n(p, old, v, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+static struct
+{
+   pthread_mutex_t busy;   // held by the thread running a parallel loop
+   pthread_mutex_t lock;   // protects everything below
+   pthread_cond_t  wake;   // generation changed
+   pthread_cond_t  done;   // active reached 0
+   pthread_cond_t  produced; // a job made work available to the others
+   pthread_cond_t  consumed; // a job finished work another one waits on
+   int count;              // requested thread count, 0 = one per cpu
+   int started;            // worker threads running, numbered 1..started
+   int limit;              // workers numbered >= limit sit the current loop out
+   int active;             // workers that haven't finished the current loop
+   unsigned int generation;
+   stbi__job_func func;
+   void *ctx;
+   int jobs;
+   int next;               // next index to hand out
+} stbi__pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                 PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                 0, 0, 0, 0, 0, NULL, NULL, 0, 0 };
+
+STBIDEF void stbi_set_thread_count(int count)
+{
+   pthread_mutex_lock(&stbi__pool.lock);
+   stbi__pool.count = count < 0 ? 0 : count;
+   pthread_mutex_unlock(&stbi__pool.lock);
+}
+
+static int stbi__thread_count(void)
+{
+   int n;
+   pthread_mutex_lock(&stbi__pool.lock);
+   n = stbi__pool.count;
+   pthread_mutex_unlock(&stbi__pool.lock);
+   if (n <= 0) n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+   if (n < 1) n = 1;
+   return n > STBI__MAX_THREADS ? STBI__MAX_THREADS : n;
+}
+
+static void stbi__pool_run(int thread)
+{
+   for (;;) {
+      int i = __atomic_fetch_add(&stbi__pool.next, 1, __ATOMIC_RELAXED);
+      if (i >= stbi__pool.jobs) break;
+      stbi__pool.func(stbi__pool.ctx, i, thread);
+   }
+}
+
+static void *stbi__pool_worker(void *arg)
+{
+   int thread = (int) (size_t) arg;
+   unsigned int seen = 0;
+   pthread_mutex_lock(&stbi__pool.lock);
+   for (;;) {
+      while (stbi__pool.generation == seen)
+         pthread_cond_wait(&stbi__pool.wake, &stbi__pool.lock);
+      seen = stbi__pool.generation;
+      if (thread < stbi__pool.limit) {
+         pthread_mutex_unlock(&stbi__pool.lock);
+         stbi__pool_run(thread);
+         pthread_mutex_lock(&stbi__pool.lock);
+      }
+      if (--stbi__pool.active == 0)
+         pthread_cond_signal(&stbi__pool.done);
+   }
+   return NULL;
+}
+
+// jobs of one loop that depend on each other sleep on the pool's lock until
+// *value >= target. whoever raises *value calls stbi__pool_wake with the same
+// cond and 'waiting' counter, so it only takes the lock when someone sleeps
+static void stbi__pool_wait(pthread_cond_t *cond, int *waiting, int *value, int target)
+{
+   pthread_mutex_lock(&stbi__pool.lock);
+   __atomic_fetch_add(waiting, 1, __ATOMIC_SEQ_CST);
+   while (stbi__atomic_load(value) < target)
+      pthread_cond_wait(cond, &stbi__pool.lock);
+   __atomic_fetch_sub(waiting, 1, __ATOMIC_SEQ_CST);
+   pthread_mutex_unlock(&stbi__pool.lock);
+}
+
+static void stbi__pool_wake(pthread_cond_t *cond, int *waiting, int all)
+{
+   // seq_cst on both sides: either the sleeper sees the new value, or this
+   // sees it waiting and signals once it's inside pthread_cond_wait
+   if (stbi__atomic_load(waiting)) {
+      pthread_mutex_lock(&stbi__pool.lock);
+      if (all)
+         pthread_cond_broadcast(cond);
+      else
+         pthread_cond_signal(cond);
+      pthread_mutex_unlock(&stbi__pool.lock);
+   }
+}
+
+static void stbi__parallel_for(stbi__job_func func, void *ctx, int count, int threads)
+{
+   int i, n = threads;
+   if (n > 1 && count > 1 && pthread_mutex_trylock(&stbi__pool.busy) == 0) {
+      pthread_mutex_lock(&stbi__pool.lock);
+      while (stbi__pool.started < n-1) {
+         pthread_t t;
+         pthread_attr_t attr;
+         int ok;
+         pthread_attr_init(&attr);
+         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+         ok = pthread_create(&t, &attr, stbi__pool_worker, (void *) (size_t) (stbi__pool.started+1)) == 0;
+         pthread_attr_destroy(&attr);
+         if (!ok) break; // run with the workers we have
+         ++stbi__pool.started;
+      }
+      stbi__pool.func = func;
+      stbi__pool.ctx = ctx;
+      stbi__pool.jobs = count;
+      stbi__pool.next = 0;
+      stbi__pool.limit = n;
+      stbi__pool.active = stbi__pool.started;
+      ++stbi__pool.generation;
+      pthread_cond_broadcast(&stbi__pool.wake);
+      pthread_mutex_unlock(&stbi__pool.lock);
+
+      stbi__pool_run(0);
+
+      pthread_mutex_lock(&stbi__pool.lock);
+      while (stbi__pool.active)
+         pthread_cond_wait(&stbi__pool.done, &stbi__pool.lock);
+      pthread_mutex_unlock(&stbi__pool.lock);
+      pthread_mutex_unlock(&stbi__pool.busy);
+      return;
+   }
+   for (i=0; i < count; ++i)
+      func(ctx, i, 0);
+}
+#else
+#define stbi__atomic_load(p)        (*(p))
+#define stbi__atomic_store(p,v)     (*(p) = (v))
+#define stbi__atomic_exchange(p,v)  stbi__exchange(p,v)
+#define stbi__atomic_cas(p,old,v)   stbi__cas(p,old,v)
+// nothing runs concurrently, so there is never anyone to wait for
+#define stbi__pool_wait(cond,waiting,value,target)  ((void) 0)
+#define stbi__pool_wake(cond,waiting,all)           ((void) 0)
+
+static int stbi__exchange(int *p, int v)
+{
+   int old = *p;
+   *p = v;
+   return old;
+}
+
+static int stbi__cas(int *p, int *old, int v)
+{
+   if (*p != *old) { *old = *p; return 0; }
+   *p = v;
+   return 1;
+}
+
+static int stbi__thread_count(void)
+{
+   return 1;
+}
+
+static void stbi__parallel_for(stbi__job_func func, void *ctx, int count, int threads)
+{
+   int i;
+   STBI_NOTUSED(threads);
+   for (i=0; i < count; ++i)
+      func(ctx, i, 0);
+}
+#endif
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1280,6 +1659,12 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
 
+   if (stbi__bgr_on_load && ri.channel_order != STBI_ORDER_BGR) {
+      int channels = req_comp ? req_comp : *comp;
+      if (channels >= 3)
+         stbi__swap_rb((stbi_uc *) result, (size_t) *x * *y, channels);
+   }
+
    return (unsigned char *) result;
 }
 
@@ -1994,12 +2379,67 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+// reconstruction into the output image, set up by load_jpeg_image
+   int            req_comp;
+   struct stbi__jpeg_reconstruct *recon;
+   int            pipelined;     // the baseline scan being decoded feeds recon's ring
+   int            reconstructed; // recon's output is complete
+   int            bgr;           // 3/4-channel output in B,G,R order, see stbi_set_bgr_on_load
+   int            yuv;           // planar output, see stbi_load_jpeg_yuv
+   int            stream_rows;   // MCU rows the planes hold, 0 = all; see stbi_jpeg_stream_open
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
-   void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
+   void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step, int bgr);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+   // 4:2:2 to RGBA in one pass, NULL if there's no fast version
+   void (*YCbCr_h_2_to_RGBA_kernel)(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int w, int count, int bgr);
 } stbi__jpeg;
 
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL int stbi__jpeg_fit_w, stbi__jpeg_fit_h;
+#else
+static int stbi__jpeg_fit_w, stbi__jpeg_fit_h;
+#endif
+
+STBIDEF void stbi_set_jpeg_fit_size(int max_w, int max_h)
+{
+   stbi__jpeg_fit_w = max_w;
+   stbi__jpeg_fit_h = max_h;
+}
+
+#ifdef STBI_JPEG_STATS
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+stbi_jpeg_stats *stbi__jpeg_stats;
+
+STBIDEF void stbi_set_jpeg_stats(stbi_jpeg_stats *stats)
+{
+   stbi__jpeg_stats = stats;
+}
+
+static void stbi__jpeg_stats_scan(stbi__jpeg *z, double seconds)
+{
+   stbi_jpeg_stats *st = stbi__jpeg_stats;
+   if (!st) return;
+   if (st->scan_count < STBI_JPEG_STATS_MAX_SCANS) {
+      stbi_jpeg_scan_stats *sc = &st->scan[st->scan_count];
+      int i;
+      sc->components = 0;
+      for (i=0; i < z->scan_n; ++i)
+         sc->components |= 1 << z->order[i];
+      sc->spec_start = z->spec_start;
+      sc->spec_end   = z->spec_end;
+      sc->succ_high  = z->succ_high;
+      sc->succ_low   = z->succ_low;
+      sc->seconds    = seconds;
+   }
+   ++st->scan_count;
+}
+#endif
+
 static int stbi__build_huffman(stbi__huffman *h, int *count)
 {
    int i,j,k=0;
@@ -2290,8 +2730,138 @@ static int stbi__jpeg_decode_block_prog_dc(stbi__jpeg *j, short data[64], stbi__
    return 1;
 }
 
-// @OPTIMIZE: store non-zigzagged during the decode passes,
-// and only de-zigzag when dequantizing
+// progressive coefficients are stored in zigzag order during the decode
+// passes (so a spectral band is contiguous) and only de-zigzagged when
+// dequantizing in stbi__jpeg_finish_mcu_row
+stbi_inline static int stbi__jpeg_zigzag_clamp(int k)
+{
+   return k < 64 ? k : 63; // let corrupt input sample past end
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define stbi__ctz64(x)  __builtin_ctzll(x)
+#else
+static int stbi__ctz64(stbi__uint64 x)
+{
+   int n = 0;
+   while (!(x & 1)) { x >>= 1; ++n; }
+   return n;
+}
+#endif
+
+// bitmask of the nonzero coefficients of a block, bit k = zigzag position k
+static stbi__uint64 stbi__jpeg_nonzero_mask(short data[64])
+{
+   stbi__uint64 zero = 0;
+   int i;
+#ifdef STBI_SSE2
+   __m128i z = _mm_setzero_si128();
+   for (i=0; i < 64; i += 16) {
+      __m128i a = _mm_cmpeq_epi16(_mm_load_si128((__m128i *) (data + i    )), z);
+      __m128i b = _mm_cmpeq_epi16(_mm_load_si128((__m128i *) (data + i + 8)), z);
+      zero |= (stbi__uint64) (unsigned int) _mm_movemask_epi8(_mm_packs_epi16(a, b)) << i;
+   }
+#else
+   for (i=0; i < 64; ++i)
+      if (data[i] == 0)
+         zero |= (stbi__uint64) 1 << i;
+#endif
+   return ~zero;
+}
+
+// refinement scans send one correction bit for every coefficient that is
+// already nonzero; read them for all coefficients in 'mask', up to 16 at a time
+static void stbi__jpeg_refine_nonzero(stbi__jpeg *j, short data[64], stbi__uint64 mask, short bit)
+{
+   while (mask) {
+      unsigned int bits;
+      int n = 0, avail;
+      if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
+      if (j->code_bits < 1) stbi__grow_buffer_unsafe(j); // hit a marker, now pads with 0s
+      avail = j->code_bits < 16 ? j->code_bits : 16;
+      bits = j->code_buffer;
+      do {
+         short *p = &data[stbi__ctz64(mask)];
+         mask &= mask - 1;
+         if ((bits & 0x80000000u) && (*p & bit) == 0)
+            *p += (*p > 0) ? bit : -bit;
+         bits <<= 1;
+         ++n;
+      } while (mask && n < avail);
+      j->code_buffer <<= n;
+      j->code_bits -= n;
+   }
+}
+
+// refinement scan for AC coefficients. instead of stepping through the band
+// one coefficient at a time, keep masks of the coefficients with and without
+// history: a run of r zero-history coefficients is skipped by clearing the
+// low r bits of the zero mask, and the correction bits for everything in
+// between are read in bulk. small run/sign symbols use the fast AC table.
+static int stbi__jpeg_decode_block_prog_ac_refine(stbi__jpeg *j, short data[64], stbi__huffman *hac, stbi__int16 *fac)
+{
+   short bit = (short) (1 << j->succ_low);
+   stbi__uint64 todo = (~(stbi__uint64) 0 >> (63 - j->spec_end)) & (~(stbi__uint64) 0 << j->spec_start);
+   stbi__uint64 nz = stbi__jpeg_nonzero_mask(data);
+
+   if (j->eob_run) {
+      --j->eob_run;
+      stbi__jpeg_refine_nonzero(j, data, nz & todo, bit);
+      return 1;
+   }
+
+   while (todo) {
+      stbi__uint64 zeros;
+      int c,r,s;
+      if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
+      c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
+      r = fac[c];
+      if (((r >> 8) == 1 || (r >> 8) == -1) && (r & 15) <= j->code_bits) { // fast-AC path: run and sign bit
+         s = r & 15; // combined length
+         j->code_buffer <<= s;
+         j->code_bits -= s;
+         s = (r >> 8) > 0 ? bit : -bit;
+         r = (r >> 4) & 15;
+      } else {
+         int rs = stbi__jpeg_huff_decode(j, hac);
+         if (rs < 0) return stbi__err("bad huffman code","Corrupt JPEG");
+         s = rs & 15;
+         r = rs >> 4;
+         if (s == 0) {
+            if (r < 15) {
+               j->eob_run = (1 << r) - 1;
+               if (r)
+                  j->eob_run += stbi__jpeg_get_bits(j, r);
+               // end of block: just the corrections for the rest of the band
+               stbi__jpeg_refine_nonzero(j, data, nz & todo, bit);
+               return 1;
+            }
+            // r=15 s=0 skips 16 zero-history coefficients: a run of 15 and
+            // then writing a 0, like the reference loop does
+         } else {
+            if (s != 1) return stbi__err("bad huffman code", "Corrupt JPEG");
+            s = stbi__jpeg_get_bit(j) ? bit : -bit;
+         }
+      }
+
+      // find the zero-history coefficient the new value lands on
+      zeros = ~nz & todo;
+      while (r-- > 0 && zeros)
+         zeros &= zeros - 1;
+      if (zeros) {
+         int z = stbi__ctz64(zeros);
+         stbi__jpeg_refine_nonzero(j, data, nz & todo & ~(~(stbi__uint64) 0 << z), bit);
+         data[z] = (short) s;
+         todo &= ~(stbi__uint64) 0 << z << 1;
+      } else {
+         // ran off the end of the band without placing it
+         stbi__jpeg_refine_nonzero(j, data, nz & todo, bit);
+         todo = 0;
+      }
+   }
+   return 1;
+}
+
 static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__huffman *hac, stbi__int16 *fac)
 {
    int k;
@@ -2318,7 +2888,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
             if (s > j->code_bits) return stbi__err("bad huffman code", "Combined length longer than code bits available");
             j->code_buffer <<= s;
             j->code_bits -= s;
-            zig = stbi__jpeg_dezigzag[k++];
+            zig = stbi__jpeg_zigzag_clamp(k++);
             data[zig] = (short) ((r >> 8) * (1 << shift));
          } else {
             int rs = stbi__jpeg_huff_decode(j, hac);
@@ -2336,11 +2906,13 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
                k += 16;
             } else {
                k += r;
-               zig = stbi__jpeg_dezigzag[k++];
+               zig = stbi__jpeg_zigzag_clamp(k++);
                data[zig] = (short) (stbi__extend_receive(j,s) * (1 << shift));
             }
          }
       } while (k <= j->spec_end);
+   } else if (!stbi__reference_kernels) {
+      return stbi__jpeg_decode_block_prog_ac_refine(j, data, hac, fac);
    } else {
       // refinement scan for these AC coefficients
 
@@ -2349,7 +2921,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
       if (j->eob_run) {
          --j->eob_run;
          for (k = j->spec_start; k <= j->spec_end; ++k) {
-            short *p = &data[stbi__jpeg_dezigzag[k]];
+            short *p = &data[k];
             if (*p != 0)
                if (stbi__jpeg_get_bit(j))
                   if ((*p & bit)==0) {
@@ -2363,7 +2935,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
          k = j->spec_start;
          do {
             int r,s;
-            int rs = stbi__jpeg_huff_decode(j, hac); // @OPTIMIZE see if we can use the fast path here, advance-by-r is so slow, eh
+            int rs = stbi__jpeg_huff_decode(j, hac);
             if (rs < 0) return stbi__err("bad huffman code","Corrupt JPEG");
             s = rs & 15;
             r = rs >> 4;
@@ -2389,7 +2961,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
 
             // advance by r
             while (k <= j->spec_end) {
-               short *p = &data[stbi__jpeg_dezigzag[k++]];
+               short *p = &data[k++];
                if (*p != 0) {
                   if (stbi__jpeg_get_bit(j))
                      if ((*p & bit)==0) {
@@ -2946,6 +3518,11 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// baseline reconstruction pipeline, see stbi__jpeg_pipelined_scan
+static short *stbi__jpeg_pipeline_slot(stbi__jpeg *z, int mcu_row);
+static short *stbi__jpeg_pipeline_block(stbi__jpeg *z, short *slot, int n, int bx, int by);
+static void   stbi__jpeg_pipeline_publish(stbi__jpeg *z, int mcu_row);
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2960,11 +3537,19 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          // component has, independent of interleaved MCU blocking and such
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
+         int v = z->img_comp[n].v;
          for (j=0; j < h; ++j) {
+            // when pipelined, only a single-component frame gets here; its MCU
+            // rows are v block rows
+            short *slot = z->pipelined ? stbi__jpeg_pipeline_slot(z, j / v) : NULL;
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (slot) {
+                  if (!stbi__jpeg_decode_block(z, stbi__jpeg_pipeline_block(z, slot, n, i, j % v), z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+               } else {
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               }
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2974,12 +3559,17 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (slot && (j % v == v-1 || j == h-1))
+               stbi__jpeg_pipeline_publish(z, j / v);
          }
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
          STBI_SIMD_ALIGN(short, data[64]);
          for (j=0; j < z->img_mcu_y; ++j) {
+            // with the pipeline running, coefficients go to the ring and
+            // other threads do the idct
+            short *slot = z->pipelined ? stbi__jpeg_pipeline_slot(z, j) : NULL;
             for (i=0; i < z->img_mcu_x; ++i) {
                // scan an interleaved mcu... process scan_n components in order
                for (k=0; k < z->scan_n; ++k) {
@@ -2991,8 +3581,12 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int x2 = (i*z->img_comp[n].h + x)*8;
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        if (slot) {
+                           if (!stbi__jpeg_decode_block(z, stbi__jpeg_pipeline_block(z, slot, n, x2 >> 3, y), z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                        } else {
+                           if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                           z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        }
                      }
                   }
                }
@@ -3004,6 +3598,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (slot)
+               stbi__jpeg_pipeline_publish(z, j);
          }
          return 1;
       }
@@ -3070,27 +3666,30 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
    }
 }
 
-static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
+static void stbi__jpeg_dequantize(short *out, short *data, stbi__uint16 *dequant)
 {
    int i;
-   for (i=0; i < 64; ++i)
-      data[i] *= dequant[i];
-}
-
-static void stbi__jpeg_finish(stbi__jpeg *z)
-{
-   if (z->progressive) {
-      // dequantize and idct the data
-      int i,j,n;
-      for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
+   for (i=0; i < 64; ++i) {
+      int zig = stbi__jpeg_dezigzag[i];
+      out[zig] = (short) (data[i] * dequant[zig]);
+   }
+}
+
+// dequantize and idct one MCU row of a progressive image's coefficients
+static void stbi__jpeg_finish_mcu_row(stbi__jpeg *z, int mcu_row)
+{
+   int i,j,n;
+   STBI_SIMD_ALIGN(short, block[64]);
+   for (n=0; n < z->s->img_n; ++n) {
+      int w = (z->img_comp[n].x+7) >> 3;
+      int h = (z->img_comp[n].y+7) >> 3;
+      int j0 = mcu_row * z->img_comp[n].v;
+      int j1 = j0 + z->img_comp[n].v < h ? j0 + z->img_comp[n].v : h;
+      for (j=j0; j < j1; ++j) {
+         for (i=0; i < w; ++i) {
+            short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+            stbi__jpeg_dequantize(block, data, z->dequant[z->img_comp[n].tq]);
+            z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, block);
          }
       }
    }
@@ -3295,7 +3894,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 
    if (scan != STBI__SCAN_load) return 1;
 
-   if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
+   // a stream never holds the whole image
+   if (!z->stream_rows && !stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
 
    for (i=0; i < s->img_n; ++i) {
       if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
@@ -3330,7 +3930,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
       z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].h2 = (z->stream_rows ? z->stream_rows : z->img_mcu_y) * z->img_comp[i].v * 8;
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3408,21 +4008,42 @@ static stbi_uc stbi__skip_jpeg_junk_at_end(stbi__jpeg *j)
    return STBI__MARKER_none;
 }
 
+static int stbi__jpeg_can_pipeline(stbi__jpeg *z);
+static int stbi__jpeg_pipelined_scan(stbi__jpeg *z);
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
    int m;
+#ifdef STBI_JPEG_STATS
+   double t;
+   if (stbi__jpeg_stats) memset(stbi__jpeg_stats, 0, sizeof(*stbi__jpeg_stats));
+#endif
    for (m = 0; m < 4; m++) {
       j->img_comp[m].raw_data = NULL;
       j->img_comp[m].raw_coeff = NULL;
    }
    j->restart_interval = 0;
    if (!stbi__decode_jpeg_header(j, STBI__SCAN_load)) return 0;
+#ifdef STBI_JPEG_STATS
+   if (stbi__jpeg_stats) stbi__jpeg_stats->progressive = j->progressive;
+#endif
    m = stbi__get_marker(j);
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
-         if (!stbi__parse_entropy_coded_data(j)) return 0;
+#ifdef STBI_JPEG_STATS
+         t = STBI_TIMER();
+#endif
+         if (stbi__jpeg_can_pipeline(j)) {
+            if (!stbi__jpeg_pipelined_scan(j)) return 0;
+         } else {
+            j->reconstructed = 0; // a later scan changed the planes
+            if (!stbi__parse_entropy_coded_data(j)) return 0;
+         }
+#ifdef STBI_JPEG_STATS
+         stbi__jpeg_stats_scan(j, STBI_TIMER() - t);
+#endif
          if (j->marker == STBI__MARKER_none ) {
          j->marker = stbi__skip_jpeg_junk_at_end(j);
             // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
@@ -3441,8 +4062,8 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
          m = stbi__get_marker(j);
       }
    }
-   if (j->progressive)
-      stbi__jpeg_finish(j);
+   // progressive coefficients are dequantized and idct'd in load_jpeg_image,
+   // together with the color conversion
    return 1;
 }
 
@@ -3655,11 +4276,12 @@ static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_
 }
 
 // this is a reduced-precision calculation of YCbCr-to-RGB introduced
-// to make sure the code produces the same results in both SIMD and scalar
+// to make sure the code produces the same results in both SIMD and scalar.
+// bgr writes B,G,R instead (see stbi_set_bgr_on_load)
 #define stbi__float2fixed(x)  (((int) ((x) * 4096.0f + 0.5f)) << 8)
-static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step, int bgr)
 {
-   int i;
+   int i, ri = bgr ? 2 : 0;
    for (i=0; i < count; ++i) {
       int y_fixed = (y[i] << 20) + (1<<19); // rounding
       int r,g,b;
@@ -3674,18 +4296,18 @@ static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc
       if ((unsigned) r > 255) { if (r < 0) r = 0; else r = 255; }
       if ((unsigned) g > 255) { if (g < 0) g = 0; else g = 255; }
       if ((unsigned) b > 255) { if (b < 0) b = 0; else b = 255; }
-      out[0] = (stbi_uc)r;
+      out[ri] = (stbi_uc)r;
       out[1] = (stbi_uc)g;
-      out[2] = (stbi_uc)b;
+      out[2-ri] = (stbi_uc)b;
       out[3] = 255;
       out += step;
    }
 }
 
 #if defined(STBI_SSE2) || defined(STBI_NEON)
-static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step, int bgr)
 {
-   int i = 0;
+   int i = 0, ri = bgr ? 2 : 0;
 
 #ifdef STBI_SSE2
    // step == 3 is pretty ugly on the final interleave, and i'm not convinced
@@ -3730,8 +4352,8 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
          __m128i bw = _mm_srai_epi16(bws, 4);
          __m128i gw = _mm_srai_epi16(gws, 4);
 
-         // back to byte, set up for transpose
-         __m128i brb = _mm_packus_epi16(rw, bw);
+         // back to byte, set up for transpose (the first half ends up in byte 0)
+         __m128i brb = bgr ? _mm_packus_epi16(bw, rw) : _mm_packus_epi16(rw, bw);
          __m128i gxb = _mm_packus_epi16(gw, xw);
 
          // transpose to interleave channels
@@ -3782,9 +4404,9 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 
          // undo scaling, round, convert to byte
          uint8x8x4_t o;
-         o.val[0] = vqrshrun_n_s16(rws, 4);
+         o.val[ri] = vqrshrun_n_s16(rws, 4);
          o.val[1] = vqrshrun_n_s16(gws, 4);
-         o.val[2] = vqrshrun_n_s16(bws, 4);
+         o.val[2-ri] = vqrshrun_n_s16(bws, 4);
          o.val[3] = vdup_n_u8(255);
 
          // store, interleaving r/g/b/a
@@ -3808,27 +4430,115 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
       if ((unsigned) r > 255) { if (r < 0) r = 0; else r = 255; }
       if ((unsigned) g > 255) { if (g < 0) g = 0; else g = 255; }
       if ((unsigned) b > 255) { if (b < 0) b = 0; else b = 255; }
-      out[0] = (stbi_uc)r;
+      out[ri] = (stbi_uc)r;
       out[1] = (stbi_uc)g;
-      out[2] = (stbi_uc)b;
+      out[2-ri] = (stbi_uc)b;
       out[3] = 255;
       out += step;
    }
 }
 #endif
 
+#ifdef STBI_SSE2
+// upsampling of 8 chroma samples to 16 as stbi__resample_row_h_2 does it,
+// left as 16-bit values. prev/next are the samples either side. these are
+// macros since gcc won't inline them
+#define stbi__h_2_sse2(lo, hi, in, prev, next) \
+   { \
+      __m128i curr = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (in)), zero); \
+      __m128i prv  = _mm_insert_epi16(_mm_slli_si128(curr, 2), prev, 0); \
+      __m128i nxt  = _mm_insert_epi16(_mm_srli_si128(curr, 2), next, 7); \
+      __m128i curb = _mm_add_epi16(_mm_add_epi16(curr, _mm_slli_epi16(curr, 1)), bias); \
+      __m128i even = _mm_add_epi16(prv, curb); \
+      __m128i odd  = _mm_add_epi16(nxt, curb); \
+      lo = _mm_srli_epi16(_mm_unpacklo_epi16(even, odd), 2); \
+      hi = _mm_srli_epi16(_mm_unpackhi_epi16(even, odd), 2); \
+   }
+
+// YCbCr->RGBA of 8 pixels as stbi__YCbCr_to_RGB_simd, from 16-bit chroma.
+// (c - 128) << 8 is what its sign flip + unpack produces from bytes
+#define stbi__YCbCr_to_RGBA_sse2(out, y, cb, cr) \
+   { \
+      __m128i yw  = _mm_unpacklo_epi8(y_bias, _mm_loadl_epi64((__m128i *) (y))); \
+      __m128i crw = _mm_slli_epi16(_mm_sub_epi16(cr, c_bias), 8); \
+      __m128i cbw = _mm_slli_epi16(_mm_sub_epi16(cb, c_bias), 8); \
+      __m128i yws = _mm_srli_epi16(yw, 4); \
+      __m128i rws = _mm_add_epi16(_mm_mulhi_epi16(cr_const0, crw), yws); \
+      __m128i gwt = _mm_add_epi16(_mm_mulhi_epi16(cb_const0, cbw), yws); \
+      __m128i bws = _mm_add_epi16(yws, _mm_mulhi_epi16(cbw, cb_const1)); \
+      __m128i gws = _mm_add_epi16(gwt, _mm_mulhi_epi16(crw, cr_const1)); \
+      __m128i brb = bgr ? _mm_packus_epi16(_mm_srai_epi16(bws, 4), _mm_srai_epi16(rws, 4)) \
+                        : _mm_packus_epi16(_mm_srai_epi16(rws, 4), _mm_srai_epi16(bws, 4)); \
+      __m128i gxb = _mm_packus_epi16(_mm_srai_epi16(gws, 4), xw); \
+      __m128i t0  = _mm_unpacklo_epi8(brb, gxb); \
+      __m128i t1  = _mm_unpackhi_epi8(brb, gxb); \
+      _mm_storeu_si128((__m128i *) (out), _mm_unpacklo_epi16(t0, t1)); \
+      _mm_storeu_si128((__m128i *) ((out) + 16), _mm_unpackhi_epi16(t0, t1)); \
+   }
+
+// 4:2:2 chroma upsampling fused with YCbCr->RGBA: the upsampled chroma stays
+// in registers instead of going through line buffers. w is the chroma width,
+// count the output width. output is identical to stbi__resample_row_h_2 on
+// both chroma planes followed by stbi__YCbCr_to_RGB_simd with step 4.
+// (4:2:0 doesn't gain from this; hv_2 and the conversion are already SIMD
+// and the line buffers stay in L1)
+static void stbi__YCbCr_h_2_to_RGBA_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int w, int count, int bgr)
+{
+   __m128i cr_const0 = _mm_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+   __m128i cr_const1 = _mm_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+   __m128i cb_const0 = _mm_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+   __m128i cb_const1 = _mm_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+   __m128i y_bias = _mm_set1_epi8((char) (unsigned char) 128);
+   __m128i c_bias = _mm_set1_epi16(128);
+   __m128i xw = _mm_set1_epi16(255); // alpha channel
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(2);
+   stbi_uc cb[16], cr[16];
+   int i = 0, k;
+
+   // process groups of 8 chroma samples for as long as we can. the first
+   // sample is its own left neighbour; the last one is handled below
+   for (; i < ((w-1) & ~7); i += 8) {
+      __m128i cblo, cbhi, crlo, crhi;
+      stbi__h_2_sse2(cblo, cbhi, pcb+i, pcb[i ? i-1 : 0], pcb[i+8]);
+      stbi__h_2_sse2(crlo, crhi, pcr+i, pcr[i ? i-1 : 0], pcr[i+8]);
+      stbi__YCbCr_to_RGBA_sse2(out + i*8,      y + i*2,     cblo, crlo);
+      stbi__YCbCr_to_RGBA_sse2(out + i*8 + 32, y + i*2 + 8, cbhi, crhi);
+   }
+
+   // the last (up to 8) chroma samples need the edge filter; upsample them
+   // into small buffers the way stbi__resample_row_h_2 does, including its
+   // left-weighted second-to-last sample
+   for (k=i; k < w; ++k) {
+      int prev = k ? k-1 : 0, next = k+1 < w ? k+1 : k;
+      if (k == w-1 && k) {
+         cb[(k-i)*2] = stbi__div4(pcb[k-1]*3 + pcb[k] + 2);
+         cr[(k-i)*2] = stbi__div4(pcr[k-1]*3 + pcr[k] + 2);
+      } else {
+         cb[(k-i)*2] = stbi__div4(pcb[k]*3 + pcb[prev] + 2);
+         cr[(k-i)*2] = stbi__div4(pcr[k]*3 + pcr[prev] + 2);
+      }
+      cb[(k-i)*2+1] = stbi__div4(pcb[k]*3 + pcb[next] + 2);
+      cr[(k-i)*2+1] = stbi__div4(pcr[k]*3 + pcr[next] + 2);
+   }
+   stbi__YCbCr_to_RGB_simd(out + i*8, y + i*2, cb, cr, count - i*2, 4, bgr);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+   j->YCbCr_h_2_to_RGBA_kernel = NULL;
 
 #ifdef STBI_SSE2
    if (stbi__sse2_available()) {
       j->idct_block_kernel = stbi__idct_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+      j->YCbCr_h_2_to_RGBA_kernel = stbi__YCbCr_h_2_to_RGBA_simd;
    }
 #endif
 
@@ -3862,167 +4572,631 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// position a resampler as if output rows [0,y) had already been generated
+static void stbi__resample_seek(stbi__resample *r, stbi__jpeg *z, int k, int y)
 {
-   int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
+   int rows = (r->vs >> 1) + y;
+   int last = z->img_comp[k].y - 1;
+   r->ystep = rows % r->vs;
+   r->ypos  = rows / r->vs;
+   r->line1 = z->img_comp[k].data + z->img_comp[k].w2 * (r->ypos < last ? r->ypos : last);
+   if (r->ypos == 0)
+      r->line0 = r->line1;
    else
-      decode_n = z->s->img_n;
-
-   // nothing to do if no components requested; check this now to avoid
-   // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
+      r->line0 = z->img_comp[k].data + z->img_comp[k].w2 * (r->ypos-1 < last ? r->ypos-1 : last);
+}
 
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
+// reconstruction of the decoded image, one MCU row at a time: dequantize and
+// idct the row (progressive), or idct it from the pipeline's ring (baseline,
+// pipelined), then upsample and color-convert whichever rows that made ready.
+// baseline rows decoded without the pipeline were idct'd during the scan
+typedef struct stbi__jpeg_reconstruct
+{
+   stbi__jpeg *z;
+   stbi_uc *output;
+   int out_w, out_h;
+   int half;                   // output at half size, see stbi_set_jpeg_fit_size
+   int yuv;                    // output Y, Cb, Cr planes instead of pixels
+   int fused;                  // YCbCr_h_2_to_RGBA_kernel does upsampling + conversion
+   int n, decode_n, is_rgb;
+   int threads;
+   stbi__resample res_comp[4]; // state at row 0; each MCU row seeks a copy
+   int *idct_done;             // per MCU row
+   int *converted;             // per MCU row
+   stbi_uc *rowbuf;            // n == 1 or 3 only, one row (+1 byte) per thread
+
+   // baseline pipeline: one thread entropy decodes MCU rows of coefficients
+   // into a ring, the others idct and convert them
+   void *raw_ring;
+   short *ring;
+   int ring_size, ring_stride;
+   int ring_offset[4];         // start of each component's blocks in a slot
+   int idct_w[4], idct_h[4];   // blocks the entropy decoder fills, per component
+   int decoded;                // MCU rows published to the ring
+   int claimed;                // MCU rows handed out for reconstruction
+   int started;                // MCU rows the entropy decoder has begun on
+   int valid_rows;             // rows past a truncated scan are left alone
+   int producing;              // someone took the entropy decoder's job
+   int idle;                   // workers asleep until more rows are decoded
+   int stalled;                // the decoder is asleep until a slot frees up
+   int scan_ok;
+} stbi__jpeg_reconstruct;
+
+// color-convert one row of (upsampled) components into n-channel output
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi_uc *out, stbi_uc *coutput[4], int n, int is_rgb, int count)
+{
+   int i, ri = z->bgr ? 2 : 0; // where red goes
+   if (n >= 3) {
+      stbi_uc *y = coutput[0];
+      if (z->s->img_n == 3) {
+         if (is_rgb) {
+            for (i=0; i < count; ++i) {
+               out[ri] = y[i];
+               out[1] = coutput[1][i];
+               out[2-ri] = coutput[2][i];
+               out[3] = 255;
+               out += n;
             }
+         } else {
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], count, n, z->bgr);
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+      } else if (z->s->img_n == 4) {
+         if (z->app14_color_transform == 0) { // CMYK
+            for (i=0; i < count; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[ri] = stbi__blinn_8x8(coutput[0][i], m);
+               out[1] = stbi__blinn_8x8(coutput[1][i], m);
+               out[2-ri] = stbi__blinn_8x8(coutput[2][i], m);
+               out[3] = 255;
+               out += n;
+            }
+         } else if (z->app14_color_transform == 2) { // YCCK
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], count, n, z->bgr);
+            for (i=0; i < count; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(255 - out[0], m);
+               out[1] = stbi__blinn_8x8(255 - out[1], m);
+               out[2] = stbi__blinn_8x8(255 - out[2], m);
+               out += n;
             }
+         } else { // YCbCr + alpha?  Ignore the fourth channel for now
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], count, n, z->bgr);
+         }
+      } else
+         for (i=0; i < count; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
+         }
+   } else {
+      if (is_rgb) {
+         if (n == 1)
+            for (i=0; i < count; ++i)
+               *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+         else {
+            for (i=0; i < count; ++i, out += 2) {
+               out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+               out[1] = 255;
+            }
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+         for (i=0; i < count; ++i) {
+            stbi_uc m = coutput[3][i];
+            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+            out[0] = stbi__compute_y(r, g, b);
+            out[1] = 255;
+            out += n;
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+         for (i=0; i < count; ++i) {
+            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            out[1] = 255;
+            out += n;
+         }
+      } else {
+         stbi_uc *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < count; ++i) out[i] = y[i];
+         else
+            for (i=0; i < count; ++i) { *out++ = y[i]; *out++ = 255; }
+      }
+   }
+}
+
+static void stbi__jpeg_convert_mcu_row(stbi__jpeg_reconstruct *rc, int mcu_row, int thread)
+{
+   stbi__jpeg *z = rc->z;
+   int n = rc->n, decode_n = rc->decode_n, is_rgb = rc->is_rgb;
+   int k;
+   unsigned int j,y0,y1;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi_uc *linebuf[4];
+   stbi__resample res_comp[4];
+
+   y0 = mcu_row * z->img_mcu_h;
+   y1 = y0 + z->img_mcu_h < z->s->img_y ? y0 + z->img_mcu_h : z->s->img_y;
+   for (k=0; k < decode_n; ++k) {
+      res_comp[k] = rc->res_comp[k];
+      stbi__resample_seek(&res_comp[k], z, k, y0);
+      linebuf[k] = rc->fused ? NULL : z->img_comp[k].linebuf + thread * (z->s->img_x + 3);
+   }
+
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *dest = rc->output + n * z->s->img_x * j;
+      stbi_uc *out = dest;
+      int aside = rc->rowbuf && j == y1-1 && j+1 < z->s->img_y;
+      // some 1- and 3-channel converters store a byte past each pixel, which
+      // for the last row of the band is the next band's first byte and may
+      // already be final; build that row on the side
+      if (aside)
+         out = rc->rowbuf + thread * (n * rc->out_w + 1);
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         if (rc->fused) // chroma is upsampled by the conversion
+            coutput[k] = y_bot ? r->line1 : r->line0;
+         else
+            coutput[k] = r->resample(linebuf[k],
+                                     y_bot ? r->line1 : r->line0,
+                                     y_bot ? r->line0 : r->line1,
+                                     r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (rc->fused)
+         z->YCbCr_h_2_to_RGBA_kernel(out, coutput[0], coutput[1], coutput[2], res_comp[1].w_lores, z->s->img_x, z->bgr);
+      else
+         stbi__jpeg_convert_row(z, out, coutput, n, is_rgb, z->s->img_x);
+      if (aside)
+         memcpy(dest, rc->rowbuf + thread * (n * rc->out_w + 1), n * rc->out_w);
+   }
+}
+
+// reduce two rows of a component to half the output width of the image.
+// full-width components (hs 1) are 2x2 averaged, half-width ones (hs 2) are
+// averaged vertically; in1 == in0 when the component is already at half height
+static stbi_uc *stbi__jpeg_half_row(stbi_uc *out, stbi_uc *in0, stbi_uc *in1, int w, int in_w, int hs)
+{
+   int i;
+   if (hs == 2) {
+      if (in0 == in1) return in0;
+      for (i=0; i < w; ++i)
+         out[i] = (stbi_uc) ((in0[i] + in1[i] + 1) >> 1);
+   } else {
+      for (i=0; i < w; ++i) {
+         int x0 = 2*i, x1 = 2*i+1 < in_w ? 2*i+1 : in_w-1;
+         out[i] = (stbi_uc) ((in0[x0] + in0[x1] + in1[x0] + in1[x1] + 2) >> 2);
+      }
+   }
+   return out;
+}
+
+static void stbi__jpeg_convert_mcu_row_half(stbi__jpeg_reconstruct *rc, int mcu_row, int thread)
+{
+   stbi__jpeg *z = rc->z;
+   int n = rc->n;
+   int k;
+   unsigned int j,y0,y1,h = z->img_mcu_h >> 1;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   y0 = mcu_row * h;
+   y1 = y0 + h < (unsigned int) rc->out_h ? y0 + h : (unsigned int) rc->out_h;
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *dest = rc->output + n * rc->out_w * j;
+      stbi_uc *out = dest;
+      int aside = rc->rowbuf && j+1 == y1 && j+1 < (unsigned int) rc->out_h;
+      if (aside)
+         out = rc->rowbuf + thread * (n * rc->out_w + 1);
+      for (k=0; k < rc->decode_n; ++k) {
+         stbi__resample *r = &rc->res_comp[k];
+         int last = z->img_comp[k].y - 1;
+         int y = r->vs == 2 ? (int) j : (int) (2*j);
+         stbi_uc *in0 = z->img_comp[k].data + z->img_comp[k].w2 * (y < last ? y : last);
+         stbi_uc *in1 = r->vs == 2 ? in0 : z->img_comp[k].data + z->img_comp[k].w2 * (y+1 < last ? y+1 : last);
+         coutput[k] = stbi__jpeg_half_row(z->img_comp[k].linebuf + thread * (z->s->img_x + 3),
+                                          in0, in1, rc->out_w, z->img_comp[k].x, r->hs);
+      }
+      stbi__jpeg_convert_row(z, out, coutput, n, rc->is_rgb, rc->out_w);
+      if (aside)
+         memcpy(dest, rc->rowbuf + thread * (n * rc->out_w + 1), n * rc->out_w);
+   }
+}
+
+// one row of an output plane from component k, box filtered fx by fy
+// (1, 2 or 4 each) with the edges repeated
+static void stbi__jpeg_plane_row(stbi__jpeg *z, stbi_uc *out, int w, int k, int row, int fx, int fy)
+{
+   stbi_uc *data = z->img_comp[k].data;
+   int stride = z->img_comp[k].w2, last = z->img_comp[k].y - 1, in_w = z->img_comp[k].x;
+   int i, j, d, y0 = row * fy;
+   stbi_uc *in0 = data + stride * (y0 < last ? y0 : last);
+   stbi_uc *in1 = data + stride * (y0+1 < last ? y0+1 : last);
+
+   if (fx == 1 && fy == 1) {
+      memcpy(out, in0, w);
+   } else if (fx == 1 && fy == 2) {
+      stbi_uc *r = stbi__jpeg_half_row(out, in0, in1, w, in_w, 2);
+      if (r != out) memcpy(out, r, w);
+   } else if (fx == 2 && fy <= 2) {
+      stbi__jpeg_half_row(out, in0, fy == 2 ? in1 : in0, w, in_w, 1);
+   } else {
+      int n = fx * fy;
+      for (i=0; i < w; ++i) {
+         int sum = n >> 1;
+         for (j=0; j < fy; ++j) {
+            stbi_uc *in = data + stride * (y0+j < last ? y0+j : last);
+            for (d=0; d < fx; ++d)
+               sum += in[i*fx+d < in_w ? i*fx+d : in_w-1];
+         }
+         out[i] = (stbi_uc) (sum / n);
+      }
+   }
+}
+
+// planar output of an MCU row: the Y rows it covers and the chroma rows
+// below them. chroma components are at full or half resolution
+static void stbi__jpeg_yuv_mcu_row(stbi__jpeg_reconstruct *rc, int mcu_row)
+{
+   stbi__jpeg *z = rc->z;
+   int scale = rc->half ? 2 : 1, h = z->img_mcu_h / scale;
+   int cw = (rc->out_w + 1) >> 1, ch = (rc->out_h + 1) >> 1;
+   int y0 = mcu_row * h, y1 = y0 + h < rc->out_h ? y0 + h : rc->out_h;
+   int j, k;
+
+   for (j=y0; j < y1; ++j)
+      stbi__jpeg_plane_row(z, rc->output + (size_t) rc->out_w * j, rc->out_w, 0, j, scale, scale);
+   for (k=1; k < rc->decode_n; ++k) {
+      stbi_uc *plane = rc->output + (size_t) rc->out_w * rc->out_h + (size_t) cw * ch * (k-1);
+      int fx = 2 * scale * z->img_comp[k].h / z->img_h_max;
+      int fy = 2 * scale * z->img_comp[k].v / z->img_v_max;
+      for (j=y0 >> 1; j < (y1+1) >> 1; ++j)
+         stbi__jpeg_plane_row(z, plane + (size_t) cw * j, cw, k, j, fx, fy);
+   }
+}
+
+static int stbi__jpeg_mcu_row_ready(stbi__jpeg_reconstruct *rc, int mcu_row)
+{
+   int last = rc->z->img_mcu_y - 1;
+   return stbi__atomic_load(&rc->idct_done[mcu_row > 0 ? mcu_row-1 : 0])
+       && stbi__atomic_load(&rc->idct_done[mcu_row])
+       && stbi__atomic_load(&rc->idct_done[mcu_row < last ? mcu_row+1 : last]);
+}
+
+static short *stbi__jpeg_pipeline_block(stbi__jpeg *z, short *slot, int n, int bx, int by)
+{
+   return slot + z->recon->ring_offset[n] + 64 * (by * (z->img_comp[n].w2 >> 3) + bx);
+}
+
+static void stbi__jpeg_pipeline_idct(stbi__jpeg_reconstruct *rc, int mcu_row)
+{
+   stbi__jpeg *z = rc->z;
+   short *slot = rc->ring + (mcu_row % rc->ring_size) * rc->ring_stride;
+   int i,j,n;
+   for (n=0; n < z->s->img_n; ++n) {
+      int j0 = mcu_row * z->img_comp[n].v;
+      int j1 = j0 + z->img_comp[n].v < rc->idct_h[n] ? j0 + z->img_comp[n].v : rc->idct_h[n];
+      for (j=j0; j < j1; ++j)
+         for (i=0; i < rc->idct_w[n]; ++i)
+            z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2,
+                                 stbi__jpeg_pipeline_block(z, slot, n, i, j-j0));
+   }
+}
+
+static void stbi__jpeg_reconstruct_row(stbi__jpeg_reconstruct *rc, int mcu_row, int thread)
+{
+   int r;
+   if (rc->z->progressive)
+      stbi__jpeg_finish_mcu_row(rc->z, mcu_row);
+   else if (rc->ring && mcu_row < stbi__atomic_load(&rc->valid_rows))
+      stbi__jpeg_pipeline_idct(rc, mcu_row);
+   stbi__atomic_store(&rc->idct_done[mcu_row], 1);
+   if (rc->ring)
+      stbi__pool_wake(&stbi__pool.consumed, &rc->stalled, 0);
+
+   // upsampling reads up to one chroma row past either end of an MCU row, so
+   // a row can be converted once both neighbours are idct'd too. whichever job
+   // finishes the last of the three converts it, while it's still in cache
+   for (r = mcu_row-1; r <= mcu_row+1; ++r)
+      if (r >= 0 && r < rc->z->img_mcu_y && stbi__jpeg_mcu_row_ready(rc, r))
+         if (!stbi__atomic_exchange(&rc->converted[r], 1)) {
+            if (rc->yuv)
+               stbi__jpeg_yuv_mcu_row(rc, r);
+            else if (rc->half)
+               stbi__jpeg_convert_mcu_row_half(rc, r, thread);
+            else
+               stbi__jpeg_convert_mcu_row(rc, r, thread);
          }
+}
+
+static void stbi__jpeg_reconstruct_job(void *ctx, int mcu_row, int thread)
+{
+   stbi__jpeg_reconstruct_row((stbi__jpeg_reconstruct *) ctx, mcu_row, thread);
+}
+
+// hand out the next MCU row that's in the ring, or -1 if there is none yet
+static int stbi__jpeg_pipeline_claim(stbi__jpeg_reconstruct *rc)
+{
+   int row = stbi__atomic_load(&rc->claimed);
+   while (row < stbi__atomic_load(&rc->decoded))
+      if (stbi__atomic_cas(&rc->claimed, &row, row+1))
+         return row;
+   return -1;
+}
+
+static short *stbi__jpeg_pipeline_slot(stbi__jpeg *z, int mcu_row)
+{
+   stbi__jpeg_reconstruct *rc = z->recon;
+   // the slot frees up once the row a full ring earlier is idct'd. help with
+   // reconstruction meanwhile, so the decoder never stalls on a busy pool;
+   // once every row in the ring is taken, sleep until the one it needs is done
+   if (mcu_row >= rc->ring_size) {
+      int *done = &rc->idct_done[mcu_row - rc->ring_size];
+      while (!stbi__atomic_load(done)) {
+         int row = stbi__jpeg_pipeline_claim(rc);
+         if (row >= 0)
+            stbi__jpeg_reconstruct_row(rc, row, 0);
+         else
+            stbi__pool_wait(&stbi__pool.consumed, &rc->stalled, done, 1);
+      }
+   }
+   rc->started = mcu_row+1;
+   return rc->ring + (mcu_row % rc->ring_size) * rc->ring_stride;
+}
+
+static void stbi__jpeg_pipeline_publish(stbi__jpeg *z, int mcu_row)
+{
+   stbi__jpeg_reconstruct *rc = z->recon;
+   stbi__atomic_store(&rc->decoded, mcu_row+1);
+   stbi__pool_wake(&stbi__pool.produced, &rc->idle, 0); // one row, one worker
+}
+
+static void stbi__jpeg_pipeline_job(void *ctx, int index, int thread)
+{
+   stbi__jpeg_reconstruct *rc = (stbi__jpeg_reconstruct *) ctx;
+   STBI_NOTUSED(index);
+
+   // the calling thread (thread 0) decodes, so errors and thread-local settings
+   // land where the caller expects them. it always gets one of the 'threads'
+   // jobs: the at most threads-1 workers can't finish theirs before it decodes
+   if (thread == 0 && !stbi__atomic_exchange(&rc->producing, 1)) {
+      rc->scan_ok = stbi__parse_entropy_coded_data(rc->z);
+      // the decoder may stop early, even mid-row (at a missing restart
+      // marker, or the last restart interval). like the serial path, idct
+      // what it got to and leave the rows it never reached as they are
+      stbi__atomic_store(&rc->valid_rows, rc->started);
+      stbi__atomic_store(&rc->decoded, rc->z->img_mcu_y);
+      stbi__pool_wake(&stbi__pool.produced, &rc->idle, 1);
+   }
+   for (;;) {
+      int row = stbi__jpeg_pipeline_claim(rc);
+      int claimed = stbi__atomic_load(&rc->claimed);
+      if (row >= 0)
+         stbi__jpeg_reconstruct_row(rc, row, thread);
+      else if (claimed >= rc->z->img_mcu_y)
+         break;
+      else // everything decoded so far is taken
+         stbi__pool_wait(&stbi__pool.produced, &rc->idle, &rc->decoded, claimed+1);
+   }
+}
+
+// decide the output format and allocate the output and per-thread buffers
+static int stbi__jpeg_reconstruct_setup(stbi__jpeg *z, stbi__jpeg_reconstruct *rc)
+{
+   int k, n, decode_n, is_rgb;
+
+   // determine actual number of components to generate
+   n = z->req_comp ? z->req_comp : z->s->img_n >= 3 ? 3 : 1;
+
+   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+
+   if (z->s->img_n == 3 && n < 3 && !is_rgb)
+      decode_n = 1;
+   else
+      decode_n = z->s->img_n;
+
+   // nothing to do if no components requested; check this now to avoid
+   // accessing uninitialized coutput[0] later
+   if (decode_n <= 0) return 0;
+
+   rc->z        = z;
+   rc->n        = n;
+   rc->decode_n = decode_n;
+   rc->is_rgb   = is_rgb;
+   rc->out_w    = z->s->img_x;
+   rc->out_h    = z->s->img_y;
+
+   // half size is only exact for components at full or half resolution
+   rc->half = stbi__jpeg_fit_w > 0 && stbi__jpeg_fit_h > 0
+           && (z->s->img_x >= 2 * (stbi__uint32) stbi__jpeg_fit_w || z->s->img_y >= 2 * (stbi__uint32) stbi__jpeg_fit_h);
+   for (k=0; k < decode_n; ++k) {
+      int hs = z->img_h_max / z->img_comp[k].h, vs = z->img_v_max / z->img_comp[k].v;
+      if (hs > 2 || vs > 2 || hs * z->img_comp[k].h != z->img_h_max || vs * z->img_comp[k].v != z->img_v_max)
+         rc->half = 0;
+   }
+   if (rc->half) {
+      rc->out_w = (z->s->img_x + 1) >> 1;
+      rc->out_h = (z->s->img_y + 1) >> 1;
+   }
+
+   rc->idct_done = (int *) stbi__malloc_mad2(z->img_mcu_y, 2 * sizeof(int), 0);
+   if (!rc->idct_done) return stbi__err("outofmem", "Out of memory");
+   memset(rc->idct_done, 0, z->img_mcu_y * 2 * sizeof(int));
+   rc->converted = rc->idct_done + z->img_mcu_y;
+
+   // planes are filtered straight from the components, no line buffers
+   rc->yuv = z->yuv;
+   if (rc->yuv) {
+      size_t luma = (size_t) rc->out_w * rc->out_h, chroma = (size_t) ((rc->out_w+1) >> 1) * ((rc->out_h+1) >> 1);
+      if (!stbi__mad3sizes_valid(rc->out_w+1, rc->out_h+1, 2, 0)) return stbi__err("too large", "Image too large to decode");
+      rc->output = (stbi_uc *) stbi__malloc(luma + 2 * chroma);
+      if (!rc->output) return stbi__err("outofmem", "Out of memory");
+      if (decode_n == 1) // grayscale
+         memset(rc->output + luma, 128, 2 * chroma);
+      return 1;
+   }
+
+   // YCbCr 4:2:2 to RGBA doesn't need the line buffers
+   rc->fused = z->YCbCr_h_2_to_RGBA_kernel && !stbi__reference_kernels && !rc->half
+            && n == 4 && decode_n == 3 && !is_rgb
+            && z->img_comp[0].h == z->img_h_max && z->img_comp[0].v == z->img_v_max
+            && z->img_comp[1].h * 2 == z->img_h_max && z->img_comp[1].v == z->img_v_max
+            && z->img_comp[2].h * 2 == z->img_h_max && z->img_comp[2].v == z->img_v_max;
+
+   for (k=0; k < decode_n; ++k) {
+      stbi__resample *r = &rc->res_comp[k];
+
+      // allocate line buffers big enough for upsampling off the edges
+      // with upsample factor of 4, one per thread
+      if (!rc->fused) {
+         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc_mad2(rc->threads, z->s->img_x + 3, 0);
+         if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+      }
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+
+   if (n == 1 || n == 3) {
+      rc->rowbuf = (stbi_uc *) stbi__malloc_mad3(rc->threads, rc->out_w, n, rc->threads);
+      if (!rc->rowbuf) return stbi__err("outofmem", "Out of memory");
+   }
+
+   rc->output = (stbi_uc *) stbi__malloc_mad3(n, rc->out_w, rc->out_h, 1);
+   if (!rc->output) return stbi__err("outofmem", "Out of memory");
+   return 1;
+}
+
+// everything but the output; linebufs go with the components
+static void stbi__jpeg_reconstruct_free(stbi__jpeg_reconstruct *rc)
+{
+   STBI_FREE(rc->idct_done);
+   STBI_FREE(rc->rowbuf);
+   STBI_FREE(rc->raw_ring);
+   rc->idct_done = NULL;
+   rc->rowbuf = NULL;
+   rc->raw_ring = NULL;
+   rc->ring = NULL;
+}
+
+// a baseline scan carrying every component can be reconstructed by other
+// threads while it's being entropy decoded
+static int stbi__jpeg_can_pipeline(stbi__jpeg *z)
+{
+   return z->recon && !z->progressive && !z->reconstructed
+       && z->scan_n == z->s->img_n && z->img_mcu_y > 1
+       && z->recon->threads > 1;
+}
+
+// entropy decode a baseline scan on the calling thread while the rest of the
+// pool reconstructs finished MCU rows from a small ring of coefficients. the
+// scan stays serial, but idct, upsampling and color conversion overlap with it
+static int stbi__jpeg_pipelined_scan(stbi__jpeg *z)
+{
+   stbi__jpeg_reconstruct *rc = z->recon;
+   int k, size = 0;
+
+   if (!rc->output && !stbi__jpeg_reconstruct_setup(z, rc)) return 0;
+
+   for (k=0; k < z->s->img_n; ++k) {
+      rc->ring_offset[k] = size;
+      if (z->s->img_n == 1) { // non-interleaved, see stbi__parse_entropy_coded_data
+         rc->idct_w[k] = (z->img_comp[k].x+7) >> 3;
+         rc->idct_h[k] = (z->img_comp[k].y+7) >> 3;
+      } else {
+         rc->idct_w[k] = z->img_mcu_x * z->img_comp[k].h;
+         rc->idct_h[k] = z->img_mcu_y * z->img_comp[k].v;
       }
+      size += 64 * (z->img_comp[k].w2 >> 3) * z->img_comp[k].v;
+   }
+   rc->ring_stride = size;
+   rc->ring_size = 2 * rc->threads;
+   rc->raw_ring = stbi__malloc_mad3(rc->ring_size, size, sizeof(short), 15);
+   if (!rc->raw_ring) { // just don't overlap
+      z->reconstructed = 0;
+      return stbi__parse_entropy_coded_data(z);
+   }
+   rc->ring = (short *) (((size_t) rc->raw_ring + 15) & ~15);
+   memset(rc->ring, 0, rc->ring_size * size * sizeof(short)); // a partly decoded row idcts defined data
+
+   memset(rc->idct_done, 0, z->img_mcu_y * 2 * sizeof(int));
+   rc->decoded = rc->claimed = rc->producing = rc->started = 0;
+   rc->idle = rc->stalled = 0;
+   rc->valid_rows = z->img_mcu_y;
+   z->pipelined = 1;
+   stbi__parallel_for(stbi__jpeg_pipeline_job, rc, rc->threads, rc->threads);
+   z->pipelined = 0;
+
+   STBI_FREE(rc->raw_ring);
+   rc->raw_ring = NULL;
+   rc->ring = NULL;
+   z->reconstructed = rc->scan_ok;
+   return rc->scan_ok;
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   stbi__jpeg_reconstruct rc;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+   memset(&rc, 0, sizeof(rc));
+   // read once: per-thread buffers are sized for it, and stbi_set_thread_count
+   // may change the setting while this image decodes
+   rc.threads = stbi__thread_count();
+   z->req_comp = req_comp;
+   z->recon = &rc;
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   // (unless a pipelined scan already produced the output)
+   if (!stbi__decode_jpeg_image(z) || (!rc.output && !stbi__jpeg_reconstruct_setup(z, &rc))) {
+      STBI_FREE(rc.output);
+      stbi__jpeg_reconstruct_free(&rc);
       stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
+      return NULL;
    }
+
+   // resample and color-convert
+   if (!z->reconstructed) {
+#ifdef STBI_JPEG_STATS
+      double t = STBI_TIMER();
+#endif
+      memset(rc.idct_done, 0, z->img_mcu_y * 2 * sizeof(int));
+      stbi__parallel_for(stbi__jpeg_reconstruct_job, &rc, z->img_mcu_y, rc.threads);
+#ifdef STBI_JPEG_STATS
+      if (stbi__jpeg_stats) stbi__jpeg_stats->reconstruct_seconds = STBI_TIMER() - t;
+#endif
+   }
+#ifdef STBI_JPEG_STATS
+   if (stbi__jpeg_stats) {
+      stbi__jpeg_stats->threads = rc.threads;
+      stbi__jpeg_stats->pipelined = z->reconstructed;
+   }
+#endif
+
+   stbi__jpeg_reconstruct_free(&rc);
+   stbi__cleanup_jpeg(z);
+   *out_x = rc.out_w;
+   *out_y = rc.out_h;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return rc.output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
@@ -4031,14 +5205,603 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    if (!j) return stbi__errpuc("outofmem", "Out of memory");
    memset(j, 0, sizeof(stbi__jpeg));
-   STBI_NOTUSED(ri);
    j->s = s;
+   j->bgr = stbi__bgr_on_load;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
+   if (j->bgr) ri->channel_order = STBI_ORDER_BGR; // rows with fewer than 3 channels have no order
+   STBI_FREE(j);
+   return result;
+}
+
+// whether stbi__jpeg_load_yuv can decode the file; reads its header
+static int stbi__jpeg_yuv_test(stbi__context *s)
+{
+   int k, h_max = 1, v_max = 1, r = 0;
+   stbi__jpeg* z = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) return stbi__err("outofmem", "Out of memory");
+   memset(z, 0, sizeof(stbi__jpeg));
+   z->s = s;
+   stbi__setup_jpeg(z);
+   if (stbi__decode_jpeg_header(z, STBI__SCAN_header)) {
+      if (s->img_n == 1) {
+         r = 1;
+      } else if (s->img_n == 3 && z->rgb != 3 && !(z->app14_color_transform == 0 && !z->jfif)) {
+         for (k=0; k < 3; ++k) {
+            if (z->img_comp[k].h > h_max) h_max = z->img_comp[k].h;
+            if (z->img_comp[k].v > v_max) v_max = z->img_comp[k].v;
+         }
+         r = z->img_comp[0].h == h_max && z->img_comp[0].v == v_max;
+         for (k=1; k < 3; ++k)
+            if ((z->img_comp[k].h != h_max && z->img_comp[k].h * 2 != h_max)
+             || (z->img_comp[k].v != v_max && z->img_comp[k].v * 2 != v_max))
+               r = 0;
+      }
+      if (!r) stbi__err("not YCbCr", "JPEG isn't YCbCr or grayscale with full resolution luma");
+   }
+   STBI_FREE(z);
+   return r;
+}
+
+static stbi_uc *stbi__jpeg_load_yuv(stbi__context *s, int *x, int *y)
+{
+   stbi_uc *result;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__errpuc("outofmem", "Out of memory");
+   memset(j, 0, sizeof(stbi__jpeg));
+   j->s = s;
+   j->yuv = 1;
+   stbi__setup_jpeg(j);
+   result = load_jpeg_image(j, x,y,NULL,0);
    STBI_FREE(j);
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_jpeg_yuv_from_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   if (!stbi__jpeg_yuv_test(&s)) return NULL;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__jpeg_load_yuv(&s,x,y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_jpeg_yuv(char const *filename, int *x, int *y)
+{
+   stbi__context s;
+   stbi_uc *result = NULL;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   // the header can be longer than what stbi__rewind can go back over
+   stbi__start_file(&s,f);
+   if (stbi__jpeg_yuv_test(&s) && fseek(f, 0, SEEK_SET) == 0) {
+      stbi__start_file(&s,f);
+      result = stbi__jpeg_load_yuv(&s,x,y);
+   }
+   fclose(f);
+   return result;
+}
+#endif
+
+// stbi_jpeg_stream: MCU row j of the scan is idct'd into slot j % 3 of the
+// planes, which then hold the rows that upsampling MCU row j-1 needs
+#define STBI__JPEG_STREAM_ROWS 3
+
+// entropy decoder state before a unit of the scan, enough to resume there
+typedef struct
+{
+   stbi__uint32 offset;      // file offset of the next byte to read
+   stbi__uint32 code_buffer;
+   int code_bits, todo;
+   stbi_uc marker, nomore;
+   short dc_pred[4];
+} stbi__jpeg_checkpoint;
+
+#define STBI__JPEG_INDEX_MAGIC    0x3158494au   // "JIX1"
+#define STBI__JPEG_INDEX_HEADER   32
+#define STBI__JPEG_INDEX_RECORD   24
+
+// the scan's units: MCUs when it's interleaved, blocks when it isn't (a
+// grayscale frame), *uw x *uh pixels each, in *cols x *rows
+static void stbi__jpeg_units(stbi__jpeg *z, int *uw, int *uh, int *cols, int *rows)
+{
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      *uw = *uh = 8;
+      *cols = (z->img_comp[n].x+7) >> 3;
+      *rows = (z->img_comp[n].y+7) >> 3;
+   } else {
+      *uw = z->img_mcu_w;
+      *uh = z->img_mcu_h;
+      *cols = z->img_mcu_x;
+      *rows = z->img_mcu_y;
+   }
+}
+
+static void stbi__jpeg_save_checkpoint(stbi__jpeg *z, stbi__uint32 offset, stbi__jpeg_checkpoint *c)
+{
+   int k;
+   c->offset = offset;
+   c->code_buffer = z->code_buffer;
+   c->code_bits = z->code_bits;
+   c->todo = z->todo;
+   c->marker = z->marker;
+   c->nomore = (stbi_uc) z->nomore;
+   for (k=0; k < 4; ++k)
+      c->dc_pred[k] = (short) (k < z->s->img_n ? z->img_comp[k].dc_pred : 0);
+}
+
+// one unit: planes[n] gets component n's blocks at unit ux,uy of the
+// planes (stride[n] bytes a row); planes NULL only runs the entropy decoder
+static int stbi__jpeg_decode_unit(stbi__jpeg *z, stbi_uc **planes, int *stride, int ux, int uy, short *data)
+{
+   int k,x,y;
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      int bh = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+      int bv = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+      for (y=0; y < bv; ++y) {
+         for (x=0; x < bh; ++x) {
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            if (planes)
+               z->idct_block_kernel(planes[n] + stride[n]*(uy*bv+y)*8 + (ux*bh+x)*8, stride[n], data);
+         }
+      }
+   }
+   return 1;
+}
+
+struct stbi_jpeg_stream
+{
+   stbi__context s;
+#ifndef STBI_NO_STDIO
+   FILE *f;
+#endif
+   stbi__jpeg z;
+   stbi__resample res_comp[4];
+   int decode_n, is_rgb;
+   int decoded;      // MCU rows entropy decoded so far
+   int stopped;      // the scan ended early or was corrupt
+   int row_y;        // output row in row, -1 if none
+   stbi_uc *row;
+   stbi__jpeg_checkpoint *index;   // see stbi__jpeg_units
+   int index_cols;   // checkpoints per unit row
+};
+
+static stbi__uint32 stbi__jpeg_stream_tell(stbi_jpeg_stream *js)
+{
+   stbi__uint32 unread = (stbi__uint32) (js->s.img_buffer_end - js->s.img_buffer);
+#ifndef STBI_NO_STDIO
+   // callbacks' skips aren't counted by the context, so ask the file
+   if (js->f) return (stbi__uint32) ftell(js->f) - unread;
+#endif
+   return (stbi__uint32) (js->s.img_buffer_end - js->s.img_buffer_original) - unread;
+}
+
+// records the checkpoint of unit col of unit row r if it has one
+static void stbi__jpeg_stream_mark(stbi_jpeg_stream *js, int r, int col)
+{
+   if (js->index && col % STBI_JPEG_INDEX_STEP == 0)
+      stbi__jpeg_save_checkpoint(&js->z, stbi__jpeg_stream_tell(js), &js->index[r * js->index_cols + col / STBI_JPEG_INDEX_STEP]);
+}
+
+// one MCU row of a baseline scan, as in stbi__parse_entropy_coded_data.
+// returns 0 on a decoding error, 2 when the scan's data ends early
+static int stbi__jpeg_stream_decode_row(stbi_jpeg_stream *js, int j)
+{
+   stbi__jpeg *z = &js->z;
+   int i,k,x,y, slot = j % STBI__JPEG_STREAM_ROWS;
+   STBI_SIMD_ALIGN(short, data[64]);
+   if (z->scan_n == 1) {
+      // non-interleaved, so only a grayscale frame gets here; its MCU rows
+      // are v block rows
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      int h = (z->img_comp[n].y+7) >> 3;
+      int v = z->img_comp[n].v;
+      for (y=0; y < v && j*v+y < h; ++y) {
+         for (i=0; i < w; ++i) {
+            int ha = z->img_comp[n].ha;
+            stbi__jpeg_stream_mark(js, j*v+y, i);
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*(slot*v+y)*8+i*8, z->img_comp[n].w2, data);
+            if (--z->todo <= 0) {
+               if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+               if (!STBI__RESTART(z->marker)) return j*v+y == h-1 && i == w-1 ? 1 : 2;
+               stbi__jpeg_reset(z);
+            }
+         }
+      }
+      return 1;
+   }
+   for (i=0; i < z->img_mcu_x; ++i) {
+      stbi__jpeg_stream_mark(js, j, i);
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         for (y=0; y < z->img_comp[n].v; ++y) {
+            for (x=0; x < z->img_comp[n].h; ++x) {
+               int x2 = (i*z->img_comp[n].h + x)*8;
+               int y2 = (slot*z->img_comp[n].v + y)*8;
+               int ha = z->img_comp[n].ha;
+               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+            }
+         }
+      }
+      if (--z->todo <= 0) {
+         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+         if (!STBI__RESTART(z->marker)) return j == z->img_mcu_y-1 && i == z->img_mcu_x-1 ? 1 : 2;
+         stbi__jpeg_reset(z);
+      }
+   }
+   return 1;
+}
+
+// row y of component k, clamped to the component, in the planes' ring
+static stbi_uc *stbi__jpeg_stream_line(stbi__jpeg *z, int k, int y)
+{
+   int last = z->img_comp[k].y - 1;
+   if (y > last) y = last;
+   return z->img_comp[k].data + z->img_comp[k].w2 * (y % (STBI__JPEG_STREAM_ROWS * z->img_comp[k].v * 8));
+}
+
+static void stbi__jpeg_stream_free(stbi_jpeg_stream *js)
+{
+   if (js->z.s) stbi__cleanup_jpeg(&js->z);
+   STBI_FREE(js->row);
+   STBI_FREE(js->index);
+#ifndef STBI_NO_STDIO
+   if (js->f) fclose(js->f);
+#endif
+   STBI_FREE(js);
+}
+
+// reads everything up to the first scan's entropy-coded data, allocating
+// planes of z->stream_rows MCU rows; only single-scan baseline frames
+static int stbi__jpeg_stream_header(stbi__jpeg *z)
+{
+   int m;
+   z->bgr = stbi__bgr_on_load;
+   stbi__setup_jpeg(z);
+   if (!stbi__decode_jpeg_header(z, STBI__SCAN_load)) return 0;
+   if (z->progressive)
+      return stbi__err("progressive", "Progressive JPEGs can't be streamed");
+   m = stbi__get_marker(z);
+   while (!stbi__SOS(m)) {
+      if (stbi__EOI(m) || !stbi__process_marker(z, m))
+         return stbi__err("no SOS", "Corrupt JPEG");
+      m = stbi__get_marker(z);
+   }
+   if (!stbi__process_scan_header(z)) return 0;
+   if (z->scan_n != z->s->img_n)
+      return stbi__err("multiple scans", "JPEGs with a scan per component can't be streamed");
+   return 1;
+}
+
+static stbi_jpeg_stream *stbi__jpeg_stream_start(stbi_jpeg_stream *js, int *x, int *y)
+{
+   stbi__jpeg *z = &js->z;
+   int k, uw, uh, cols, rows;
+   z->s = &js->s;
+   z->stream_rows = STBI__JPEG_STREAM_ROWS;
+   if (!stbi__jpeg_stream_header(z)) goto fail;
+
+   // the index is only a convenience: without memory for it, stream anyway
+   stbi__jpeg_units(z, &uw, &uh, &cols, &rows);
+   js->index_cols = (cols + STBI_JPEG_INDEX_STEP-1) / STBI_JPEG_INDEX_STEP;
+   js->index = (stbi__jpeg_checkpoint *) stbi__malloc_mad3(js->index_cols, rows, sizeof(stbi__jpeg_checkpoint), 0);
+
+   js->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   js->decode_n = z->s->img_n;
+   for (k=0; k < js->decode_n; ++k) {
+      stbi__resample *r = &js->res_comp[k];
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!z->img_comp[k].linebuf) goto outofmem;
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+   js->row = (stbi_uc *) stbi__malloc_mad2(z->s->img_x, 4, 0);
+   if (!js->row) goto outofmem;
+   js->row_y = -1;
+   stbi__jpeg_reset(z);
+
+   *x = z->s->img_x;
+   *y = z->s->img_y;
+   return js;
+
+outofmem:
+   stbi__err("outofmem", "Out of memory");
+fail:
+   stbi__jpeg_stream_free(js);
+   return NULL;
+}
+
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi_jpeg_stream *js = (stbi_jpeg_stream *) stbi__malloc(sizeof(*js));
+   if (!js) return (stbi_jpeg_stream *) stbi__errpuc("outofmem", "Out of memory");
+   memset(js, 0, sizeof(*js));
+   stbi__start_mem(&js->s, buffer, len);
+   return stbi__jpeg_stream_start(js, x, y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open(char const *filename, int *x, int *y)
+{
+   stbi_jpeg_stream *js;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stbi_jpeg_stream *) stbi__errpuc("can't fopen", "Unable to open file");
+   js = (stbi_jpeg_stream *) stbi__malloc(sizeof(*js));
+   if (!js) {
+      fclose(f);
+      return (stbi_jpeg_stream *) stbi__errpuc("outofmem", "Out of memory");
+   }
+   memset(js, 0, sizeof(*js));
+   js->f = f;
+   stbi__start_file(&js->s, f);
+   return stbi__jpeg_stream_start(js, x, y);
+}
+#endif
+
+STBIDEF stbi_uc const *stbi_jpeg_stream_row(stbi_jpeg_stream *js, int y)
+{
+   stbi__jpeg *z = &js->z;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   int k, need;
+
+   if (y < 0) y = 0;
+   if (y >= (int) z->s->img_y) y = z->s->img_y - 1;
+   if (y == js->row_y) return js->row;
+
+   // MCU row r upsamples from the last rows of r-1 and the first of r+1
+   need = y / z->img_mcu_h + 1;
+   if (need >= z->img_mcu_y) need = z->img_mcu_y - 1;
+   while (js->decoded <= need) {
+      if (!js->stopped && stbi__jpeg_stream_decode_row(js, js->decoded) != 1)
+         js->stopped = 1;
+      ++js->decoded;
+   }
+
+   // same rows as stbi__resample_seek picks
+   for (k=0; k < js->decode_n; ++k) {
+      stbi__resample *r = &js->res_comp[k];
+      int rows = (r->vs >> 1) + y;
+      int ypos = rows / r->vs, y_bot = rows % r->vs >= (r->vs >> 1);
+      stbi_uc *line1 = stbi__jpeg_stream_line(z, k, ypos);
+      stbi_uc *line0 = ypos ? stbi__jpeg_stream_line(z, k, ypos-1) : line1;
+      coutput[k] = r->resample(z->img_comp[k].linebuf, y_bot ? line1 : line0, y_bot ? line0 : line1, r->w_lores, r->hs);
+   }
+   stbi__jpeg_convert_row(z, js->row, coutput, 4, js->is_rgb, z->s->img_x);
+   js->row_y = y;
+   return js->row;
+}
+
+STBIDEF void stbi_jpeg_stream_close(stbi_jpeg_stream *js)
+{
+   if (js) stbi__jpeg_stream_free(js);
+}
+
+static void stbi__jpeg_index_put32(stbi_uc *p, stbi__uint32 v)
+{
+   p[0] = STBI__BYTECAST(v);
+   p[1] = STBI__BYTECAST(v >> 8);
+   p[2] = STBI__BYTECAST(v >> 16);
+   p[3] = STBI__BYTECAST(v >> 24);
+}
+
+static stbi__uint32 stbi__jpeg_index_get32(stbi_uc const *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((stbi__uint32) p[3] << 24);
+}
+
+// the blob is a header of 8 little-endian uint32s (magic, x, y, components,
+// unit columns and rows, STBI_JPEG_INDEX_STEP, checkpoint count) and then
+// the checkpoints, unit row by unit row:
+//    uint32 offset, code_buffer; uint8 code_bits, marker, nomore, 0;
+//    int32 todo; int16 dc_pred[4]
+STBIDEF void *stbi_jpeg_stream_index(stbi_jpeg_stream *js, int *len)
+{
+   stbi__jpeg *z = &js->z;
+   stbi_uc *blob, *p;
+   int uw, uh, cols, rows, n, i, k;
+
+   if (!js->index || js->stopped || js->decoded < z->img_mcu_y)
+      return stbi__errpuc("incomplete", "Scan not decoded to the end");
+   stbi__jpeg_units(z, &uw, &uh, &cols, &rows);
+   n = js->index_cols * rows;
+   blob = (stbi_uc *) stbi__malloc_mad2(n, STBI__JPEG_INDEX_RECORD, STBI__JPEG_INDEX_HEADER);
+   if (!blob) return stbi__errpuc("outofmem", "Out of memory");
+   stbi__jpeg_index_put32(blob,    STBI__JPEG_INDEX_MAGIC);
+   stbi__jpeg_index_put32(blob+4,  z->s->img_x);
+   stbi__jpeg_index_put32(blob+8,  z->s->img_y);
+   stbi__jpeg_index_put32(blob+12, z->s->img_n);
+   stbi__jpeg_index_put32(blob+16, cols);
+   stbi__jpeg_index_put32(blob+20, rows);
+   stbi__jpeg_index_put32(blob+24, STBI_JPEG_INDEX_STEP);
+   stbi__jpeg_index_put32(blob+28, n);
+   p = blob + STBI__JPEG_INDEX_HEADER;
+   for (i=0; i < n; ++i, p += STBI__JPEG_INDEX_RECORD) {
+      stbi__jpeg_checkpoint *c = &js->index[i];
+      stbi__jpeg_index_put32(p, c->offset);
+      stbi__jpeg_index_put32(p+4, c->code_buffer);
+      p[8] = (stbi_uc) c->code_bits;
+      p[9] = c->marker;
+      p[10] = c->nomore;
+      p[11] = 0;
+      stbi__jpeg_index_put32(p+12, (stbi__uint32) c->todo);
+      for (k=0; k < 4; ++k) {
+         p[16+2*k] = STBI__BYTECAST(c->dc_pred[k]);
+         p[17+2*k] = STBI__BYTECAST(c->dc_pred[k] >> 8);
+      }
+   }
+   *len = STBI__JPEG_INDEX_HEADER + n * STBI__JPEG_INDEX_RECORD;
+   return blob;
+}
+
+#ifndef STBI_NO_STDIO
+// entropy decodes unit row r of the scan from the last checkpoint at or
+// before unit uc0 up to uc1, idct'ing the units from uc0 on into planes
+// (whose first unit is uc0, ur0). the index comes from a cache the caller
+// doesn't control, so a checkpoint the decoder couldn't have written is an error
+static int stbi__jpeg_region_row(stbi__jpeg *z, FILE *f, long size, stbi_uc const *rec, stbi_uc **planes, int *stride, int r, int ur0, int uc0, int uc1)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int c, k;
+   stbi__uint32 offset = stbi__jpeg_index_get32(rec);
+   if (offset > (stbi__uint32) size || rec[8] > 32 || (int) stbi__jpeg_index_get32(rec+12) <= 0
+       || fseek(f, (long) offset, SEEK_SET))
+      return stbi__err("bad index", "Index doesn't match the JPEG");
+   stbi__start_file(z->s, f);
+   z->code_buffer = stbi__jpeg_index_get32(rec+4);
+   z->code_bits = rec[8];
+   z->marker = rec[9];
+   z->nomore = rec[10];
+   z->todo = (int) stbi__jpeg_index_get32(rec+12);
+   z->eob_run = 0;
+   for (k=0; k < z->s->img_n; ++k)
+      z->img_comp[k].dc_pred = (short) (rec[16+2*k] | (rec[17+2*k] << 8));
+   for (c = uc0 / STBI_JPEG_INDEX_STEP * STBI_JPEG_INDEX_STEP; c <= uc1; ++c) {
+      if (!stbi__jpeg_decode_unit(z, c >= uc0 ? planes : NULL, stride, c - uc0, r - ur0, data)) return 0;
+      if (--z->todo <= 0) {
+         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+         if (!STBI__RESTART(z->marker)) break;   // the scan ends early; stbi_load leaves the rest alone too
+         stbi__jpeg_reset(z);
+      }
+   }
+   return 1;
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_region(char const *filename, void const *index, int index_len, int x, int y, int w, int h)
+{
+   stbi_uc const *ix = (stbi_uc const *) index;
+   stbi_uc *planes[4] = { NULL, NULL, NULL, NULL }, *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi_uc *out = NULL, *row = NULL;
+   int stride[4], unit_w[4], unit_h[4];
+   stbi__resample res_comp[4];
+   stbi__context s;
+   stbi__jpeg *z;
+   FILE *f;
+   long size;
+   int uw, uh, cols, rows, icols, uc0, uc1, ur0, ur1, px0, rw, is_rgb, k, r, j;
+
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   z = (stbi__jpeg *) stbi__malloc(sizeof(*z));
+   if (!z) {
+      fclose(f);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
+   memset(z, 0, sizeof(*z));
+   memset(&s, 0, sizeof(s));
+   stbi__start_file(&s, f);
+   z->s = &s;
+   z->stream_rows = 1;   // the frame's own planes go unused
+   if (!stbi__jpeg_stream_header(z)) goto fail;
+
+   stbi__jpeg_units(z, &uw, &uh, &cols, &rows);
+   icols = (cols + STBI_JPEG_INDEX_STEP-1) / STBI_JPEG_INDEX_STEP;
+   if (index_len < STBI__JPEG_INDEX_HEADER
+       || stbi__jpeg_index_get32(ix)    != STBI__JPEG_INDEX_MAGIC
+       || stbi__jpeg_index_get32(ix+4)  != z->s->img_x
+       || stbi__jpeg_index_get32(ix+8)  != z->s->img_y
+       || stbi__jpeg_index_get32(ix+12) != (stbi__uint32) z->s->img_n
+       || stbi__jpeg_index_get32(ix+16) != (stbi__uint32) cols
+       || stbi__jpeg_index_get32(ix+20) != (stbi__uint32) rows
+       || stbi__jpeg_index_get32(ix+24) != STBI_JPEG_INDEX_STEP
+       || stbi__jpeg_index_get32(ix+28) != (stbi__uint32) (icols * rows)
+       || (index_len - STBI__JPEG_INDEX_HEADER) / STBI__JPEG_INDEX_RECORD != icols * rows) {
+      stbi__err("bad index", "Index doesn't match the JPEG");
+      goto fail;
+   }
+   if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > (int) z->s->img_x - x || h > (int) z->s->img_y - y) {
+      stbi__err("bad region", "Region outside the image");
+      goto fail;
+   }
+
+   // a unit of margin all round, so upsampling sees the same neighbours
+   // as it does over the whole image
+   uc0 = x / uw - 1;           if (uc0 < 0) uc0 = 0;
+   uc1 = (x + w-1) / uw + 1;   if (uc1 > cols-1) uc1 = cols-1;
+   ur0 = y / uh - 1;           if (ur0 < 0) ur0 = 0;
+   ur1 = (y + h-1) / uh + 1;   if (ur1 > rows-1) ur1 = rows-1;
+   px0 = uc0 * uw;
+   rw = ((uc1+1) * uw < (int) z->s->img_x ? (uc1+1) * uw : (int) z->s->img_x) - px0;
+
+   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   for (k=0; k < z->s->img_n; ++k) {
+      stbi__resample *rs = &res_comp[k];
+      unit_w[k] = z->scan_n == 1 ? 8 : z->img_comp[k].h * 8;
+      unit_h[k] = z->scan_n == 1 ? 8 : z->img_comp[k].v * 8;
+      stride[k] = (uc1 - uc0 + 1) * unit_w[k];
+      planes[k] = (stbi_uc *) stbi__malloc_mad2(stride[k], (ur1 - ur0 + 1) * unit_h[k], 0);
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(rw + 3);
+      if (!planes[k] || !z->img_comp[k].linebuf) goto outofmem;
+      rs->hs      = z->img_h_max / z->img_comp[k].h;
+      rs->vs      = z->img_v_max / z->img_comp[k].v;
+      rs->w_lores = (rw + rs->hs-1) / rs->hs;
+      if      (rs->hs == 1 && rs->vs == 1) rs->resample = resample_row_1;
+      else if (rs->hs == 1 && rs->vs == 2) rs->resample = stbi__resample_row_v_2;
+      else if (rs->hs == 2 && rs->vs == 1) rs->resample = stbi__resample_row_h_2;
+      else if (rs->hs == 2 && rs->vs == 2) rs->resample = z->resample_row_hv_2_kernel;
+      else                                 rs->resample = stbi__resample_row_generic;
+   }
+   row = (stbi_uc *) stbi__malloc_mad2(rw, 4, 0);
+   out = (stbi_uc *) stbi__malloc_mad3(w, h, 4, 0);
+   if (!row || !out) goto outofmem;
+
+   if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0) {
+      stbi__err("can't fopen", "Unable to read file");
+      goto fail;
+   }
+   for (r = ur0; r <= ur1; ++r) {
+      stbi_uc const *rec = ix + STBI__JPEG_INDEX_HEADER + (r * icols + uc0 / STBI_JPEG_INDEX_STEP) * STBI__JPEG_INDEX_RECORD;
+      if (!stbi__jpeg_region_row(z, f, size, rec, planes, stride, r, ur0, uc0, uc1)) goto fail;
+   }
+
+   // the rows stbi_jpeg_stream_row would pick, offset to the planes
+   for (j=0; j < h; ++j) {
+      for (k=0; k < z->s->img_n; ++k) {
+         stbi__resample *rs = &res_comp[k];
+         int last = z->img_comp[k].y - 1, top = ur0 * unit_h[k];
+         int rows_k = (rs->vs >> 1) + y + j;
+         int ypos = rows_k / rs->vs, y_bot = rows_k % rs->vs >= (rs->vs >> 1);
+         int y1 = ypos < last ? ypos : last, y0 = ypos ? (ypos-1 < last ? ypos-1 : last) : y1;
+         stbi_uc *line1 = planes[k] + stride[k] * (y1 - top);
+         stbi_uc *line0 = planes[k] + stride[k] * (y0 - top);
+         coutput[k] = rs->resample(z->img_comp[k].linebuf, y_bot ? line1 : line0, y_bot ? line0 : line1, rs->w_lores, rs->hs);
+      }
+      stbi__jpeg_convert_row(z, row, coutput, 4, is_rgb, rw);
+      memcpy(out + (size_t) j * w * 4, row + (size_t) (x - px0) * 4, (size_t) w * 4);
+   }
+
+   for (k=0; k < 4; ++k) STBI_FREE(planes[k]);
+   STBI_FREE(row);
+   stbi__cleanup_jpeg(z);
+   STBI_FREE(z);
+   fclose(f);
+   return out;
+
+outofmem:
+   stbi__err("outofmem", "Out of memory");
+fail:
+   for (k=0; k < 4; ++k) STBI_FREE(planes[k]);
+   STBI_FREE(row);
+   STBI_FREE(out);
+   stbi__cleanup_jpeg(z);
+   STBI_FREE(z);
+   fclose(f);
+   return NULL;
+}
+#endif // STBI_NO_STDIO
+
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
@@ -6555,6 +8318,8 @@ typedef struct
    stbi__int16 prefix;
    stbi_uc first;
    stbi_uc suffix;
+   stbi__int32 offset;   // fast decoder: where the string was first output in dict
+   stbi__int32 len;      // ... and how long it is
 } stbi__gif_lzw;
 
 typedef struct
@@ -6563,6 +8328,7 @@ typedef struct
    stbi_uc *out;                 // output buffer (always 4 components)
    stbi_uc *background;          // The current "background" as far as a gif is concerned
    stbi_uc *history;
+   stbi_uc *dict;                // palette indices of the current frame, in decode order
    int flags, bgindex, ratio, transparent, eflags;
    stbi_uc  pal[256][4];
    stbi_uc lpal[256][4];
@@ -6575,6 +8341,7 @@ typedef struct
    int cur_x, cur_y;
    int line_size;
    int delay;
+   int bgr;                      // output B,G,R,A, see stbi_set_bgr_on_load
 } stbi__gif;
 
 static int stbi__gif_test_raw(stbi__context *s)
@@ -6669,9 +8436,9 @@ static void stbi__out_gif_code(stbi__gif *g, stbi__uint16 code)
 
    c = &g->color_table[g->codes[code].suffix * 4];
    if (c[3] > 128) { // don't render transparent pixels;
-      p[0] = c[2];
+      p[0] = c[g->bgr ? 0 : 2];
       p[1] = c[1];
-      p[2] = c[0];
+      p[2] = c[g->bgr ? 2 : 0];
       p[3] = c[3];
    }
    g->cur_x += 4;
@@ -6688,6 +8455,41 @@ static void stbi__out_gif_code(stbi__gif *g, stbi__uint16 code)
    }
 }
 
+// fast path of stbi__out_gif_code: writes n palette indices in one go, a
+// row-sized run at a time. rgba is the color table already swizzled to the
+// output order.
+static void stbi__out_gif_indices(stbi__gif *g, stbi_uc const *idx, int n, stbi_uc const (*rgba)[4])
+{
+   while (n > 0 && g->cur_y < g->max_y) {
+      int pos = g->cur_x + g->cur_y;
+      int run = (g->max_x - g->cur_x) >> 2, i;
+      stbi_uc *p = &g->out[pos];
+      stbi_uc *h = &g->history[pos / 4];
+      if (run > n) run = n;
+
+      for (i=0; i < run; ++i, p += 4) {
+         stbi_uc const *c = rgba[idx[i]];
+         h[i] = 1;
+         if (c[3] > 128) // don't render transparent pixels;
+            memcpy(p, c, 4);
+      }
+      idx += run;
+      n -= run;
+
+      g->cur_x += run * 4;
+      if (g->cur_x >= g->max_x) {
+         g->cur_x = g->start_x;
+         g->cur_y += g->step;
+
+         while (g->cur_y >= g->max_y && g->parse > 0) {
+            g->step = (1 << g->parse) * g->line_size;
+            g->cur_y = g->start_y + (g->step >> 1);
+            --g->parse;
+         }
+      }
+   }
+}
+
 static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
 {
    stbi_uc lzw_cs;
@@ -6695,9 +8497,29 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
    stbi__uint32 first;
    stbi__int32 codesize, codemask, avail, oldcode, bits, valid_bits, clear;
    stbi__gif_lzw *p;
+   // the fast decoder keeps every index of the frame in g->dict; each code
+   // remembers where its string was first output there, so emitting a code
+   // is a single copy instead of a walk down its prefix chain
+   int fast = !stbi__reference_kernels;
+   stbi__int32 pos = 0, last = 0, size = 0;
+   stbi_uc rgba[256][4];
 
    lzw_cs = stbi__get8(s);
    if (lzw_cs > 12) return NULL;
+   if (fast) {
+      int fw = (g->max_x - g->start_x) >> 2;
+      size = fw ? fw * ((g->max_y - g->start_y) / g->line_size) : 0;
+      if (!g->dict && size) {
+         g->dict = (stbi_uc *) stbi__malloc(g->w * g->h);
+         if (!g->dict) return stbi__errpuc("outofmem", "Out of memory");
+      }
+      for (init_code = 0; init_code < 256; init_code++) {
+         rgba[init_code][0] = g->color_table[init_code*4 + (g->bgr ? 0 : 2)];
+         rgba[init_code][1] = g->color_table[init_code*4+1];
+         rgba[init_code][2] = g->color_table[init_code*4 + (g->bgr ? 2 : 0)];
+         rgba[init_code][3] = g->color_table[init_code*4+3];
+      }
+   }
    clear = 1 << lzw_cs;
    first = 1;
    codesize = lzw_cs + 1;
@@ -6708,6 +8530,7 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
       g->codes[init_code].prefix = -1;
       g->codes[init_code].first = (stbi_uc) init_code;
       g->codes[init_code].suffix = (stbi_uc) init_code;
+      g->codes[init_code].len = 1;
    }
 
    // support no starting clear code
@@ -6755,10 +8578,35 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
                p->prefix = (stbi__int16) oldcode;
                p->first = g->codes[oldcode].first;
                p->suffix = (code == avail) ? p->first : g->codes[code].first;
+               // the previous string plus the first index of this one, which
+               // follows it directly in dict
+               p->offset = last;
+               p->len = g->codes[oldcode].len + 1;
             } else if (code == avail)
                return stbi__errpuc("illegal code in raster", "Corrupt GIF");
 
-            stbi__out_gif_code(g, (stbi__uint16) code);
+            if (fast) {
+               stbi__int32 n = g->codes[code].len;
+               if (n > size - pos) n = size - pos; // the rest falls outside the frame
+               if (n > 0) {
+                  stbi_uc *d = g->dict + pos;
+                  if (code < clear)
+                     *d = (stbi_uc) code;
+                  else {
+                     stbi_uc const *src = g->dict + g->codes[code].offset;
+                     if (src + n <= d)
+                        memcpy(d, src, n);
+                     else { // code defined by this very string: its last index repeats its first
+                        stbi__int32 i;
+                        for (i=0; i < n; ++i) d[i] = src[i];
+                     }
+                  }
+                  stbi__out_gif_indices(g, d, n, (stbi_uc const (*)[4]) rgba);
+               }
+               last = pos;
+               pos += n;
+            } else
+               stbi__out_gif_code(g, (stbi__uint16) code);
 
             if ((avail & codemask) == 0 && avail <= 0x0FFF) {
                codesize++;
@@ -6953,6 +8801,7 @@ static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **dela
 {
    STBI_FREE(g->out);
    STBI_FREE(g->history);
+   STBI_FREE(g->dict);
    STBI_FREE(g->background);
 
    if (out) STBI_FREE(out);
@@ -7032,6 +8881,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
       // free temp buffer;
       STBI_FREE(g.out);
       STBI_FREE(g.history);
+      STBI_FREE(g.dict);
       STBI_FREE(g.background);
 
       // do the final conversion after loading everything;
@@ -7050,7 +8900,9 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
    stbi_uc *u = 0;
    stbi__gif g;
    memset(&g, 0, sizeof(g));
-   STBI_NOTUSED(ri);
+   // 1- and 2-channel conversions below need the canvas in RGB order
+   g.bgr = stbi__bgr_on_load && (req_comp == 0 || req_comp >= 3);
+   if (g.bgr) ri->channel_order = STBI_ORDER_BGR;
 
    u = stbi__gif_load_next(s, &g, comp, req_comp, 0);
    if (u == (stbi_uc *) s) u = 0;  // end of animated gif marker
@@ -7069,11 +8921,220 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    // free buffers needed for multiple frame loading;
    STBI_FREE(g.history);
+   STBI_FREE(g.dict);
    STBI_FREE(g.background);
 
    return u;
 }
 
+struct stbi_gif_stream
+{
+   stbi__context s;
+   stbi__gif g;
+#ifndef STBI_NO_STDIO
+   FILE *f;                  // NULL when decoding from memory
+#endif
+   stbi_uc const *buffer;
+   int len;
+   int frame;                // frames decoded since the start
+   int bgr;                  // stbi_set_bgr_on_load at open time
+   stbi_uc *back[2];         // the last two frames, back[frame & 1] is the older
+   int rect[4];              // what changed in the last frame
+};
+
+static void stbi__gif_stream_free_frames(stbi__gif *g)
+{
+   STBI_FREE(g->out);
+   STBI_FREE(g->history);
+   STBI_FREE(g->dict);
+   STBI_FREE(g->background);
+   memset(g, 0, sizeof(*g));
+}
+
+// copy a rectangle of one canvas to another
+static void stbi__gif_copy_rect(stbi_uc *dst, stbi_uc const *src, int stride, int const rect[4])
+{
+   int j;
+   for (j=rect[1]; j < rect[1] + rect[3]; ++j)
+      memcpy(dst + j*stride + rect[0]*4, src + j*stride + rect[0]*4, rect[2]*4);
+}
+
+static void stbi__gif_rect_union(int r[4], int const o[4])
+{
+   int x1 = r[0] + r[2], y1 = r[1] + r[3];
+   if (o[2] <= 0 || o[3] <= 0) return;
+   if (r[2] <= 0 || r[3] <= 0) {
+      memcpy(r, o, 4 * sizeof(int));
+      return;
+   }
+   if (o[0] + o[2] > x1) x1 = o[0] + o[2];
+   if (o[1] + o[3] > y1) y1 = o[1] + o[3];
+   if (o[0] < r[0]) r[0] = o[0];
+   if (o[1] < r[1]) r[1] = o[1];
+   r[2] = x1 - r[0];
+   r[3] = y1 - r[1];
+}
+
+static int stbi__gif_stream_begin(stbi_gif_stream *gs)
+{
+#ifndef STBI_NO_STDIO
+   if (gs->f) {
+      if (fseek(gs->f, 0, SEEK_SET) != 0) return stbi__err("can't fseek", "Unable to rewind file");
+      stbi__start_file(&gs->s, gs->f);
+   } else
+#endif
+      stbi__start_mem(&gs->s, gs->buffer, gs->len);
+   stbi__gif_stream_free_frames(&gs->g);
+   gs->g.bgr = gs->bgr;
+   gs->frame = 0;
+   return 1;
+}
+
+static stbi_gif_stream *stbi__gif_stream_start(stbi_gif_stream *gs, int *x, int *y)
+{
+   int w, h;
+   gs->bgr = stbi__bgr_on_load;
+   if (!stbi__gif_stream_begin(gs))
+      goto fail;
+   if (!stbi__gif_test(&gs->s)) {
+      stbi__err("not GIF", "Image was not as a gif type.");
+      goto fail;
+   }
+   if (!stbi__gif_info_raw(&gs->s, &w, &h, NULL))
+      goto fail;
+   stbi__rewind(&gs->s);
+   if (w <= 0 || h <= 0 || !stbi__mad3sizes_valid(4, w, h, 0)) {
+      stbi__err("too large", "GIF image is too large");
+      goto fail;
+   }
+   gs->back[0] = (stbi_uc *) stbi__malloc_mad3(4, w, h, 0);
+   gs->back[1] = (stbi_uc *) stbi__malloc_mad3(4, w, h, 0);
+   if (!gs->back[0] || !gs->back[1]) {
+      stbi__err("outofmem", "Out of memory");
+      goto fail;
+   }
+   if (x) *x = w;
+   if (y) *y = h;
+   return gs;
+
+fail:
+   stbi_gif_stream_close(gs);
+   return NULL;
+}
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi_gif_stream *gs = (stbi_gif_stream *) stbi__malloc(sizeof(*gs));
+   if (!gs) {
+      stbi__err("outofmem", "Out of memory");
+      return NULL;
+   }
+   memset(gs, 0, sizeof(*gs));
+   gs->buffer = buffer;
+   gs->len = len;
+   return stbi__gif_stream_start(gs, x, y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(char const *filename, int *x, int *y)
+{
+   stbi_gif_stream *gs;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) {
+      stbi__err("can't fopen", "Unable to open file");
+      return NULL;
+   }
+   gs = (stbi_gif_stream *) stbi__malloc(sizeof(*gs));
+   if (!gs) {
+      fclose(f);
+      stbi__err("outofmem", "Out of memory");
+      return NULL;
+   }
+   memset(gs, 0, sizeof(*gs));
+   gs->f = f;
+   return stbi__gif_stream_start(gs, x, y);
+}
+#endif
+
+STBIDEF stbi_uc const *stbi_gif_stream_next(stbi_gif_stream *gs, int *delay_ms, int rect[4])
+{
+   stbi__gif *g = &gs->g;
+   stbi_uc *u, *two_back = gs->frame >= 2 ? gs->back[gs->frame & 1] : NULL;
+   int stride, dirty[4], disposed[4] = { 0, 0, 0, 0 };
+
+   // disposing of the previous frame can only touch the pixels it drew
+   if (gs->frame > 0) {
+      int dispose = (g->eflags & 0x1C) >> 2;
+      if (dispose == 2 || dispose == 3) {
+         disposed[0] = g->start_x / 4;
+         disposed[1] = g->start_y / g->line_size;
+         disposed[2] = (g->max_x - g->start_x) / 4;
+         disposed[3] = (g->max_y - g->start_y) / g->line_size;
+      }
+   }
+
+   u = stbi__gif_load_next(&gs->s, g, NULL, 4, two_back);
+   if (!u || u == (stbi_uc *) &gs->s) return NULL;
+
+   stride = g->w * 4;
+   if (gs->frame == 0) {
+      // everything is new, and pixels the first frame doesn't draw get the background colour
+      dirty[0] = dirty[1] = 0;
+      dirty[2] = g->w;
+      dirty[3] = g->h;
+   } else {
+      dirty[0] = g->start_x / 4;
+      dirty[1] = g->start_y / g->line_size;
+      dirty[2] = (g->max_x - g->start_x) / 4;
+      dirty[3] = (g->max_y - g->start_y) / g->line_size;
+      stbi__gif_rect_union(dirty, disposed);
+   }
+
+   // the slot two_back came from becomes this frame. it differs from this
+   // frame only where this frame or the previous one changed something
+   if (gs->frame < 2) {
+      memcpy(gs->back[gs->frame & 1], u, (size_t) stride * g->h);
+   } else {
+      stbi__gif_copy_rect(gs->back[gs->frame & 1], u, stride, gs->rect);
+      stbi__gif_copy_rect(gs->back[gs->frame & 1], u, stride, dirty);
+   }
+   memcpy(gs->rect, dirty, sizeof(dirty));
+   ++gs->frame;
+
+   if (delay_ms) *delay_ms = g->delay;
+   if (rect) memcpy(rect, dirty, sizeof(dirty));
+   return u;
+}
+
+STBIDEF int stbi_gif_stream_more(stbi_gif_stream *gs)
+{
+   // peek at the next block: another frame starts with an extension or an
+   // image descriptor, the end with the trailer (or end of data)
+   stbi__context *s = &gs->s;
+   if (s->img_buffer >= s->img_buffer_end && s->read_from_callbacks)
+      stbi__refill_buffer(s);
+   if (s->img_buffer >= s->img_buffer_end)
+      return 0;
+   return *s->img_buffer == 0x21 || *s->img_buffer == 0x2C;
+}
+
+STBIDEF int stbi_gif_stream_rewind(stbi_gif_stream *gs)
+{
+   return stbi__gif_stream_begin(gs);
+}
+
+STBIDEF void stbi_gif_stream_close(stbi_gif_stream *gs)
+{
+   if (!gs) return;
+   stbi__gif_stream_free_frames(&gs->g);
+   STBI_FREE(gs->back[0]);
+   STBI_FREE(gs->back[1]);
+#ifndef STBI_NO_STDIO
+   if (gs->f) fclose(gs->f);
+#endif
+   STBI_FREE(gs);
+}
+
 static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
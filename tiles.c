@@ -0,0 +1,190 @@
+// Texture chia ô cho ảnh lớn (xem tiles.h)
+
+#include "tiles.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Kích thước lõi tile trên một chiều: cả chiều nếu vừa texture, nếu không thì
+// giới hạn trừ viền hai bên (chẵn cho IYUV)
+static int tiles_step(int size, int max) {
+    if (max <= 0 || size <= max) return size;
+    int step = (max - 2 * TILES_BORDER) & ~1;
+    return step > 0 ? step : 2;
+}
+
+TiledTexture *tiles_create(SDL_Renderer *renderer, Uint32 format, int access, int w, int h, int max_tile) {
+    SDL_RendererInfo info;
+    int max_w = 0, max_h = 0;   // 0 = renderer không báo giới hạn
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        max_w = info.max_texture_width;
+        max_h = info.max_texture_height;
+    }
+    const char *env = getenv("IMGV_TILE_MAX");
+    int limit = env ? atoi(env) : 0;
+    if (max_tile > 2 * TILES_BORDER && (limit <= 2 * TILES_BORDER || max_tile < limit))
+        limit = max_tile;
+    if (limit > 2 * TILES_BORDER) {
+        if (max_w <= 0 || limit < max_w) max_w = limit;
+        if (max_h <= 0 || limit < max_h) max_h = limit;
+    }
+
+    TiledTexture *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->renderer = renderer;
+    t->format = format;
+    t->access = access;
+    t->w = w;
+    t->h = h;
+    t->step_w = tiles_step(w, max_w);
+    t->step_h = tiles_step(h, max_h);
+    t->cols = (w + t->step_w - 1) / t->step_w;
+    t->rows = (h + t->step_h - 1) / t->step_h;
+    t->tiles = calloc((size_t)t->cols * t->rows, sizeof(*t->tiles));
+    t->failed = calloc((size_t)t->cols * t->rows, 1);
+    if (!t->tiles || !t->failed) {
+        tiles_destroy(t);
+        return NULL;
+    }
+    t->pending = t->cols * t->rows;
+    return t;
+}
+
+static void tiles_drop_pixels(TiledTexture *t) {
+    if (t->own_pixels) pool_free(t->pixels);
+    t->pixels = NULL;
+    t->own_pixels = 0;
+}
+
+void tiles_destroy(TiledTexture *t) {
+    if (!t) return;
+    if (t->tiles) {
+        for (int i = 0; i < t->cols * t->rows; i++)
+            if (t->tiles[i]) SDL_DestroyTexture(t->tiles[i]);
+    }
+    tiles_drop_pixels(t);
+    free(t->tiles);
+    free(t->failed);
+    free(t);
+}
+
+void tiles_set_pixels(TiledTexture *t, unsigned char *pixels, int own) {
+    tiles_drop_pixels(t);
+    t->pixels = pixels;
+    t->own_pixels = own;
+}
+
+// Vùng ảnh của texture tile (col, row): phần lõi cộng viền, cắt theo mép ảnh
+static SDL_Rect tiles_texture_rect(const TiledTexture *t, int col, int row) {
+    int x0 = col * t->step_w - TILES_BORDER, y0 = row * t->step_h - TILES_BORDER;
+    int x1 = (col + 1) * t->step_w + TILES_BORDER, y1 = (row + 1) * t->step_h + TILES_BORDER;
+    if (t->cols == 1) x0 = 0, x1 = t->w;
+    if (t->rows == 1) y0 = 0, y1 = t->h;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > t->w) x1 = t->w;
+    if (y1 > t->h) y1 = t->h;
+    SDL_Rect r = { x0, y0, x1 - x0, y1 - y0 };
+    return r;
+}
+
+// Tạo texture cho tile và tải lên từ pixels (cả ảnh theo format, pitch của
+// mặt phẳng đầu); NULL nếu SDL không tạo được, khi đó tile bị bỏ qua về sau
+static SDL_Texture *tiles_load(TiledTexture *t, int i, const unsigned char *pixels, int pitch) {
+    const SDL_Rect r = tiles_texture_rect(t, i % t->cols, i / t->cols);
+    SDL_Texture *texture = SDL_CreateTexture(t->renderer, t->format, t->access, r.w, r.h);
+    if (!texture) {
+        fprintf(stderr, "Warning: cannot create %dx%d texture tile: %s\n", r.w, r.h, SDL_GetError());
+        t->failed[i] = 1;
+        t->pending--;
+        return NULL;
+    }
+    if (t->scale_mode_set)
+        SDL_SetTextureScaleMode(texture, t->scale_mode);
+
+    if (t->format == SDL_PIXELFORMAT_IYUV) {
+        // Cb, Cr nằm sau Y, mỗi mặt phẳng nửa kích thước (làm tròn lên); r.x, r.y chẵn
+        int cw = (t->w + 1) / 2;
+        const unsigned char *cb = pixels + (size_t)t->w * t->h;
+        const unsigned char *cr = cb + (size_t)cw * ((t->h + 1) / 2);
+        size_t chroma = (size_t)(r.y / 2) * cw + r.x / 2;
+        SDL_UpdateYUVTexture(texture, NULL, pixels + (size_t)r.y * t->w + r.x, t->w,
+                             cb + chroma, cw, cr + chroma, cw);
+    } else {
+        SDL_UpdateTexture(texture, NULL, pixels + (size_t)r.y * pitch + (size_t)r.x * 4, pitch);
+    }
+    t->tiles[i] = texture;
+    t->pending--;
+    return texture;
+}
+
+// Tải lên tile i từ ảnh nguồn nếu còn; bỏ ảnh nguồn khi không còn tile nào chờ
+static void tiles_load_pending(TiledTexture *t, int i) {
+    if (t->tiles[i] || t->failed[i] || !t->pixels) return;
+    tiles_load(t, i, t->pixels, t->w * 4);
+    if (t->pending == 0)
+        tiles_drop_pixels(t);
+}
+
+void tiles_upload_all(TiledTexture *t) {
+    for (int i = 0; i < t->cols * t->rows && t->pixels; i++)
+        tiles_load_pending(t, i);
+    tiles_drop_pixels(t);
+}
+
+void tiles_update(TiledTexture *t, const SDL_Rect *rect, const unsigned char *pixels, int pitch) {
+    SDL_Rect all = { 0, 0, t->w, t->h };
+    if (!rect) rect = &all;
+    for (int i = 0; i < t->cols * t->rows; i++) {
+        SDL_Rect tr = tiles_texture_rect(t, i % t->cols, i / t->cols), part;
+        if (t->failed[i] || !SDL_IntersectRect(&tr, rect, &part)) continue;
+        if (!t->tiles[i]) {
+            tiles_load(t, i, pixels, pitch);
+            continue;
+        }
+        SDL_Rect local = { part.x - tr.x, part.y - tr.y, part.w, part.h };
+        SDL_UpdateTexture(t->tiles[i], &local, pixels + (size_t)part.y * pitch + (size_t)part.x * 4, pitch);
+    }
+}
+
+void tiles_set_scale_mode(TiledTexture *t, SDL_ScaleMode mode) {
+    t->scale_mode = mode;
+    t->scale_mode_set = 1;
+    for (int i = 0; i < t->cols * t->rows; i++)
+        if (t->tiles[i]) SDL_SetTextureScaleMode(t->tiles[i], mode);
+}
+
+void tiles_draw(TiledTexture *t, const SDL_Rect *src, const SDL_FRect *dst) {
+    SDL_Rect all = { 0, 0, t->w, t->h }, view;
+    if (!SDL_IntersectRect(src ? src : &all, &all, &view)) return;
+    SDL_FRect out;
+    if (dst) {
+        out = *dst;
+    } else {
+        int ow, oh;
+        SDL_GetRendererOutputSize(t->renderer, &ow, &oh);
+        out.x = out.y = 0;
+        out.w = ow;
+        out.h = oh;
+    }
+    // Tọa độ ảnh -> renderer; các tile kề nhau chung mép nên không có khe
+    float sx = out.w / view.w, sy = out.h / view.h;
+
+    int c0 = view.x / t->step_w, c1 = (view.x + view.w - 1) / t->step_w;
+    int r0 = view.y / t->step_h, r1 = (view.y + view.h - 1) / t->step_h;
+    for (int row = r0; row <= r1; row++) {
+        for (int col = c0; col <= c1; col++) {
+            int i = row * t->cols + col;
+            tiles_load_pending(t, i);
+            if (!t->tiles[i]) continue;
+            SDL_Rect core = { col * t->step_w, row * t->step_h, t->step_w, t->step_h }, part;
+            SDL_IntersectRect(&core, &view, &part);
+            SDL_Rect tr = tiles_texture_rect(t, col, row);
+            SDL_Rect from = { part.x - tr.x, part.y - tr.y, part.w, part.h };
+            SDL_FRect to = { out.x + (part.x - view.x) * sx, out.y + (part.y - view.y) * sy,
+                             part.w * sx, part.h * sy };
+            SDL_RenderCopyF(t->renderer, t->tiles[i], &from, &to);
+        }
+    }
+}
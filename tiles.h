@@ -0,0 +1,64 @@
+// tiles.h - Texture chia ô cho ảnh lớn hơn giới hạn texture của renderer
+//
+// SDL_CreateTexture thất bại khi ảnh vượt max_texture_width/height của renderer
+// (4096 hoặc 8192 trên nhiều GPU). TiledTexture chia ảnh thành lưới tile không
+// lớn hơn giới hạn đó; mỗi tile lấy thêm TILES_BORDER pixel của tile bên cạnh để
+// filter tuyến tính ở mép tile không tạo đường nối. Tile chỉ được tạo và tải lên
+// khi lần đầu nằm trong vùng được vẽ, và chỉ các tile đó được vẽ. Ảnh vừa một
+// texture thì là đúng một tile kích thước ảnh như trước.
+//
+// Biến môi trường IMGV_TILE_MAX: giới hạn kích thước tile nhỏ hơn của renderer
+// (để thử chia ô trên GPU lớn).
+
+#ifndef IMGV_TILES_H
+#define IMGV_TILES_H
+
+#include <SDL2/SDL.h>
+
+// SDL_ScaleMode và SDL_SetTextureScaleMode có từ SDL 2.0.12 (SDL_RenderCopyF,
+// SDL_RenderFlush từ 2.0.10)
+#if !SDL_VERSION_ATLEAST(2, 0, 12)
+#error "imgv cần SDL 2.0.12 trở lên"
+#endif
+
+#define TILES_BORDER 2   // chẵn để mặt phẳng Cb, Cr của IYUV cắt đúng chỗ
+
+typedef struct {
+    SDL_Renderer *renderer;
+    Uint32 format;            // RGBA32/BGRA32, hoặc IYUV (ba mặt phẳng như image_bytes)
+    int access;               // SDL_TEXTUREACCESS_STATIC hoặc _STREAMING
+    int w, h;                 // kích thước ảnh
+    int step_w, step_h;       // phần lõi của mỗi tile, không tính viền
+    int cols, rows;
+    SDL_Texture **tiles;      // cols * rows, NULL = chưa tải lên
+    unsigned char *failed;    // tile không tạo được texture, không thử lại
+    unsigned char *pixels;    // ảnh nguồn cho các tile chưa tải lên (NULL nếu không còn)
+    int own_pixels;           // pool_free pixels khi mọi tile đã tải lên
+    int pending;              // số tile chưa tải lên
+    int scale_mode_set;
+    SDL_ScaleMode scale_mode;
+} TiledTexture;
+
+// Chỉ tính lưới tile, chưa tạo texture nào; NULL nếu hết bộ nhớ. max_tile > 0:
+// tile không lớn hơn max_tile dù renderer cho phép (để chỉ tải lên vùng đang nhìn)
+TiledTexture *tiles_create(SDL_Renderer *renderer, Uint32 format, int access, int w, int h, int max_tile);
+void tiles_destroy(TiledTexture *t);
+
+// Ảnh nguồn w x h theo format để tải lên các tile khi cần. own = 1: TiledTexture
+// giữ bộ đệm (cấp từ pool) và giải phóng khi tile cuối cùng đã tải lên; own = 0:
+// bộ đệm phải còn tới khi gọi tiles_upload_all
+void tiles_set_pixels(TiledTexture *t, unsigned char *pixels, int own);
+// Tải lên ngay các tile còn lại rồi bỏ ảnh nguồn
+void tiles_upload_all(TiledTexture *t);
+
+// Cập nhật vùng rect (NULL = cả ảnh) từ pixels (cả ảnh, pitch byte mỗi dòng,
+// 4 byte/pixel); tile chưa có texture được tạo và tải lên trọn từ pixels
+void tiles_update(TiledTexture *t, const SDL_Rect *rect, const unsigned char *pixels, int pitch);
+
+void tiles_set_scale_mode(TiledTexture *t, SDL_ScaleMode mode);
+
+// Vẽ vùng src của ảnh (NULL = cả ảnh) vào dst (NULL = cả renderer), chỉ các tile
+// giao với src; tile chưa tải lên được tải lên từ ảnh nguồn nếu còn
+void tiles_draw(TiledTexture *t, const SDL_Rect *src, const SDL_FRect *dst);
+
+#endif // IMGV_TILES_H